@@ -0,0 +1,67 @@
+#ifndef HBX_H
+#define HBX_H
+
+/*
+ * Collision queries over the .hbx files written by sbhitbox
+ *
+ * Every part keeps its triangles as SoA arrays with room for three more at the end so they can be
+ * tested four at a time. Queries are answered in the space the .hbx was written in, any bone transform
+ * has to be applied to the query by the caller.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct hbx_part {
+    uint32_t tri_count; // Two triangles per quad
+    float * v0[3]; // First vertex
+    float * e1[3]; // v1 - v0
+    float * e2[3]; // v2 - v0
+    float * n[3]; // Unit face normal
+    uint64_t * flags; // One per quad
+
+    uint32_t node_count;
+    float * node_min[3];
+    float * node_max[3];
+    uint32_t * node_skip;
+    uint32_t * node_first; // In quads
+    uint32_t * node_count_quads;
+};
+
+struct hbx_bone {
+    uint8_t part;
+    char * name;
+};
+
+struct hbx {
+    uint32_t part_count;
+    struct hbx_part * parts;
+    uint32_t bone_count;
+    struct hbx_bone * bones;
+};
+
+struct hbx_hit {
+    float t; // Distance along the query direction, 0 for overlaps
+    float normal[3];
+    uint32_t part;
+    uint32_t quad;
+    uint64_t flags;
+};
+
+struct hbx * hbx_load(const char * path);
+void hbx_free(struct hbx * hbx);
+
+// Closest hit along a ray, dir has to be normalized
+bool hbx_raycast(const struct hbx * hbx, const float origin[3], const float dir[3], float max_t,
+    struct hbx_hit * hit);
+
+// Closest hit of a sphere moving along dir, dir has to be normalized
+bool hbx_sweep_sphere(const struct hbx * hbx, const float origin[3], const float dir[3], float radius,
+    float max_t, struct hbx_hit * hit);
+
+// Every quad touching the box, returns the total number found even if more than max_hits
+size_t hbx_overlap_aabb(const struct hbx * hbx, const float min[3], const float max[3],
+    struct hbx_hit * hits, size_t max_hits);
+
+#endif
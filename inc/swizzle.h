@@ -23,6 +23,14 @@
 
 #include <stdint.h>
 
+void generate_swizzle_masks(
+    unsigned int width,
+    unsigned int height,
+    unsigned int depth,
+    uint32_t *mask_x,
+    uint32_t *mask_y,
+    uint32_t *mask_z);
+
 void swizzle_box(
     const uint8_t *src_buf,
     unsigned int width,
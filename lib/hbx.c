@@ -0,0 +1,647 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "hbx.h"
+
+/*
+ * Four wide helpers, SSE2 when available and plain loops otherwise. Masks are all bits set per
+ * lane so they can be combined with the bitwise helpers in both versions.
+ */
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+typedef __m128 vec4;
+
+static inline vec4 v4_load(const float * p) { return _mm_loadu_ps(p); }
+static inline void v4_store(float * p, vec4 a) { _mm_storeu_ps(p, a); }
+static inline vec4 v4_set(float x) { return _mm_set1_ps(x); }
+static inline vec4 v4_index(uint32_t i) { return _mm_setr_ps(i, i + 1, i + 2, i + 3); }
+static inline vec4 v4_add(vec4 a, vec4 b) { return _mm_add_ps(a, b); }
+static inline vec4 v4_sub(vec4 a, vec4 b) { return _mm_sub_ps(a, b); }
+static inline vec4 v4_mul(vec4 a, vec4 b) { return _mm_mul_ps(a, b); }
+static inline vec4 v4_div(vec4 a, vec4 b) { return _mm_div_ps(a, b); }
+static inline vec4 v4_min(vec4 a, vec4 b) { return _mm_min_ps(a, b); }
+static inline vec4 v4_max(vec4 a, vec4 b) { return _mm_max_ps(a, b); }
+static inline vec4 v4_abs(vec4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline vec4 v4_lt(vec4 a, vec4 b) { return _mm_cmplt_ps(a, b); }
+static inline vec4 v4_le(vec4 a, vec4 b) { return _mm_cmple_ps(a, b); }
+static inline vec4 v4_and(vec4 a, vec4 b) { return _mm_and_ps(a, b); }
+static inline vec4 v4_andnot(vec4 a, vec4 b) { return _mm_andnot_ps(a, b); }
+static inline vec4 v4_or(vec4 a, vec4 b) { return _mm_or_ps(a, b); }
+static inline int v4_mask(vec4 a) { return _mm_movemask_ps(a); }
+#else
+typedef union {
+    float f[4];
+    uint32_t u[4];
+} vec4;
+
+#define V4_LANES(expr) vec4 r; for (int l = 0; l < 4; l++) expr; return r
+static inline vec4 v4_load(const float * p) { V4_LANES(r.f[l] = p[l]); }
+static inline void v4_store(float * p, vec4 a) { memcpy(p, a.f, sizeof(a.f)); }
+static inline vec4 v4_set(float x) { V4_LANES(r.f[l] = x); }
+static inline vec4 v4_index(uint32_t i) { V4_LANES(r.f[l] = i + l); }
+static inline vec4 v4_add(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] + b.f[l]); }
+static inline vec4 v4_sub(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] - b.f[l]); }
+static inline vec4 v4_mul(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] * b.f[l]); }
+static inline vec4 v4_div(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] / b.f[l]); }
+static inline vec4 v4_min(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] < b.f[l] ? a.f[l] : b.f[l]); }
+static inline vec4 v4_max(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] > b.f[l] ? a.f[l] : b.f[l]); }
+static inline vec4 v4_abs(vec4 a) { V4_LANES(r.f[l] = fabsf(a.f[l])); }
+static inline vec4 v4_lt(vec4 a, vec4 b) { V4_LANES(r.u[l] = a.f[l] < b.f[l] ? ~0u : 0); }
+static inline vec4 v4_le(vec4 a, vec4 b) { V4_LANES(r.u[l] = a.f[l] <= b.f[l] ? ~0u : 0); }
+static inline vec4 v4_and(vec4 a, vec4 b) { V4_LANES(r.u[l] = a.u[l] & b.u[l]); }
+static inline vec4 v4_andnot(vec4 a, vec4 b) { V4_LANES(r.u[l] = ~a.u[l] & b.u[l]); }
+static inline vec4 v4_or(vec4 a, vec4 b) { V4_LANES(r.u[l] = a.u[l] | b.u[l]); }
+static inline int v4_mask(vec4 a) {
+    return (a.u[0] >> 31) | (a.u[1] >> 31) << 1 | (a.u[2] >> 31) << 2 | (a.u[3] >> 31) << 3;
+}
+#undef V4_LANES
+#endif
+
+static inline vec4 v4_select(vec4 mask, vec4 a, vec4 b) {
+    return v4_or(v4_and(mask, a), v4_andnot(mask, b));
+}
+
+static inline float dot3(const float a[3], const float b[3]) {
+    return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+static inline vec4 v4_dot(const vec4 a[3], const vec4 b[3]) {
+    return v4_add(v4_add(v4_mul(a[0], b[0]), v4_mul(a[1], b[1])), v4_mul(a[2], b[2]));
+}
+
+static inline void v4_cross(vec4 out[3], const vec4 a[3], const vec4 b[3]) {
+    out[0] = v4_sub(v4_mul(a[1], b[2]), v4_mul(a[2], b[1]));
+    out[1] = v4_sub(v4_mul(a[2], b[0]), v4_mul(a[0], b[2]));
+    out[2] = v4_sub(v4_mul(a[0], b[1]), v4_mul(a[1], b[0]));
+}
+
+// Loads four triangles starting at i, only lanes below end are valid
+static inline vec4 load_tris(const struct hbx_part * part, uint32_t i, uint32_t end,
+    vec4 v0[3], vec4 e1[3], vec4 e2[3], vec4 n[3]) {
+    for (int a = 0; a < 3; a++) {
+        v0[a] = v4_load(part->v0[a] + i);
+        e1[a] = v4_load(part->e1[a] + i);
+        e2[a] = v4_load(part->e2[a] + i);
+        if (n) n[a] = v4_load(part->n[a] + i);
+    }
+    return v4_lt(v4_index(i), v4_set(end));
+}
+
+static void fill_hit(const struct hbx_part * part, uint32_t p, uint32_t tri, float t, const float dir[3],
+    struct hbx_hit * hit) {
+    hit->t = t;
+    hit->part = p;
+    hit->quad = tri / 2;
+    hit->flags = part->flags[tri / 2];
+
+    // Face the normal towards the query
+    float sign = 1.0f;
+    for (int a = 0; a < 3; a++) hit->normal[a] = part->n[a][tri];
+    if (dir && dot3(hit->normal, dir) > 0.0f) sign = -1.0f;
+    for (int a = 0; a < 3; a++) hit->normal[a] *= sign;
+}
+
+static bool read_data(void * dst, size_t size, const uint8_t ** src, const uint8_t * end) {
+    if (*src + size > end) return false;
+    memcpy(dst, *src, size);
+    *src += size;
+    return true;
+}
+
+struct hbx * hbx_load(const char * path) {
+    FILE * f = fopen(path, "rb");
+    if (!f) return NULL;
+
+    fseek(f, 0, SEEK_END);
+    size_t file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    uint8_t * file = malloc(file_size);
+    size_t r = fread(file, 1, file_size, f);
+    fclose(f);
+    if (r != file_size) {
+        free(file);
+        return NULL;
+    }
+
+    const uint8_t * src = file;
+    const uint8_t * end = file + file_size;
+
+    struct hbx * hbx = calloc(1, sizeof(struct hbx));
+    if (!read_data(&hbx->part_count, sizeof(uint32_t), &src, end)) goto fail;
+    hbx->parts = calloc(hbx->part_count, sizeof(struct hbx_part));
+
+    for (uint32_t p = 0; p < hbx->part_count; p++) {
+        struct hbx_part * part = hbx->parts + p;
+
+        uint32_t quad_count;
+        if (!read_data(&quad_count, sizeof(uint32_t), &src, end)) goto fail;
+        if (src + quad_count * (6 * 3 * sizeof(float) + sizeof(uint64_t)) > end) goto fail;
+
+        // Three spare triangles at the end so any four can be loaded at once
+        part->tri_count = quad_count * 2;
+        size_t stride = part->tri_count + 3;
+        float * soa = calloc(stride * 12, sizeof(float));
+        for (int a = 0; a < 3; a++) {
+            part->v0[a] = soa + stride * a;
+            part->e1[a] = soa + stride * (3 + a);
+            part->e2[a] = soa + stride * (6 + a);
+            part->n[a] = soa + stride * (9 + a);
+        }
+
+        for (uint32_t t = 0; t < part->tri_count; t++) {
+            float v[3][3];
+            read_data(v, sizeof(v), &src, end);
+
+            float n[3];
+            for (int a = 0; a < 3; a++) {
+                part->v0[a][t] = v[0][a];
+                part->e1[a][t] = v[1][a] - v[0][a];
+                part->e2[a][t] = v[2][a] - v[0][a];
+            }
+            n[0] = part->e1[1][t] * part->e2[2][t] - part->e1[2][t] * part->e2[1][t];
+            n[1] = part->e1[2][t] * part->e2[0][t] - part->e1[0][t] * part->e2[2][t];
+            n[2] = part->e1[0][t] * part->e2[1][t] - part->e1[1][t] * part->e2[0][t];
+
+            float len = sqrtf(dot3(n, n));
+            for (int a = 0; a < 3; a++) part->n[a][t] = len > 0.0f ? n[a] / len : 0.0f;
+        }
+
+        part->flags = malloc(quad_count * sizeof(uint64_t));
+        read_data(part->flags, quad_count * sizeof(uint64_t), &src, end);
+    }
+
+    uint8_t bone_count;
+    if (!read_data(&bone_count, sizeof(uint8_t), &src, end)) goto fail;
+    hbx->bone_count = bone_count;
+    hbx->bones = calloc(bone_count + 1, sizeof(struct hbx_bone));
+
+    for (uint32_t b = 0; b < hbx->bone_count; b++) {
+        uint32_t name_len;
+        if (!read_data(&hbx->bones[b].part, sizeof(uint8_t), &src, end)) goto fail;
+        if (!read_data(&name_len, sizeof(uint32_t), &src, end)) goto fail;
+        hbx->bones[b].name = calloc(name_len + 1, sizeof(char));
+        if (!read_data(hbx->bones[b].name, name_len, &src, end)) goto fail;
+    }
+
+    // Older files without a hierarchy get a single node per part
+    bool has_bvh = src + 4 <= end && !memcmp(src, "BVH0", 4);
+    if (has_bvh) src += 4;
+
+    for (uint32_t p = 0; p < hbx->part_count; p++) {
+        struct hbx_part * part = hbx->parts + p;
+
+        part->node_count = 1;
+        if (has_bvh && !read_data(&part->node_count, sizeof(uint32_t), &src, end)) goto fail;
+
+        size_t n = part->node_count;
+        float * bounds = malloc(n * 6 * sizeof(float));
+        uint32_t * links = malloc(n * 3 * sizeof(uint32_t));
+        for (int a = 0; a < 3; a++) {
+            part->node_min[a] = bounds + n * a;
+            part->node_max[a] = bounds + n * (3 + a);
+        }
+        part->node_skip = links;
+        part->node_first = links + n;
+        part->node_count_quads = links + n * 2;
+
+        if (has_bvh) {
+            if (!read_data(bounds, n * 6 * sizeof(float), &src, end)) goto fail;
+            if (!read_data(links, n * 3 * sizeof(uint32_t), &src, end)) goto fail;
+
+            for (uint32_t ni = 0; ni < n; ni++) {
+                if (part->node_skip[ni] <= ni || part->node_skip[ni] > n ||
+                    (uint64_t)part->node_first[ni] + part->node_count_quads[ni] > part->tri_count / 2) goto fail;
+            }
+            continue;
+        }
+
+        part->node_skip[0] = 1;
+        part->node_first[0] = 0;
+        part->node_count_quads[0] = part->tri_count / 2;
+        for (int a = 0; a < 3; a++) {
+            part->node_min[a][0] = INFINITY;
+            part->node_max[a][0] = -INFINITY;
+            for (uint32_t t = 0; t < part->tri_count; t++) {
+                float v0 = part->v0[a][t];
+                float v1 = v0 + part->e1[a][t];
+                float v2 = v0 + part->e2[a][t];
+                part->node_min[a][0] = fminf(part->node_min[a][0], fminf(v0, fminf(v1, v2)));
+                part->node_max[a][0] = fmaxf(part->node_max[a][0], fmaxf(v0, fmaxf(v1, v2)));
+            }
+        }
+    }
+
+    free(file);
+    return hbx;
+
+fail:
+    free(file);
+    hbx_free(hbx);
+    return NULL;
+}
+
+void hbx_free(struct hbx * hbx) {
+    if (!hbx) return;
+
+    for (uint32_t p = 0; hbx->parts && p < hbx->part_count; p++) {
+        free(hbx->parts[p].v0[0]);
+        free(hbx->parts[p].flags);
+        free(hbx->parts[p].node_min[0]);
+        free(hbx->parts[p].node_skip);
+    }
+    for (uint32_t b = 0; hbx->bones && b < hbx->bone_count; b++) free(hbx->bones[b].name);
+
+    free(hbx->parts);
+    free(hbx->bones);
+    free(hbx);
+}
+
+// Next leaf from ni on whose box (grown by margin) the ray enters before max_t
+static uint32_t next_leaf_ray(const struct hbx_part * part, uint32_t ni, const float origin[3],
+    const float inv_dir[3], float margin, float max_t) {
+    while (ni < part->node_count) {
+        float tmin = 0.0f, tmax = max_t;
+        for (int a = 0; a < 3; a++) {
+            float t0 = (part->node_min[a][ni] - margin - origin[a]) * inv_dir[a];
+            float t1 = (part->node_max[a][ni] + margin - origin[a]) * inv_dir[a];
+            tmin = fmaxf(tmin, fminf(t0, t1));
+            tmax = fminf(tmax, fmaxf(t0, t1));
+        }
+
+        if (tmin > tmax) ni = part->node_skip[ni];
+        else if (part->node_skip[ni] == ni + 1) return ni;
+        else ni++;
+    }
+
+    return ni;
+}
+
+// Next leaf from ni whose box overlaps min/max
+static uint32_t next_leaf_box(const struct hbx_part * part, uint32_t ni, const float min[3], const float max[3]) {
+    while (ni < part->node_count) {
+        bool overlap = true;
+        for (int a = 0; a < 3; a++) {
+            if (part->node_min[a][ni] > max[a] || part->node_max[a][ni] < min[a]) overlap = false;
+        }
+
+        if (!overlap) ni = part->node_skip[ni];
+        else if (part->node_skip[ni] == ni + 1) return ni;
+        else ni++;
+    }
+
+    return ni;
+}
+
+// Moller-Trumbore against four triangles at a time, both sides count as a hit
+static bool raycast_part(const struct hbx_part * part, uint32_t start, uint32_t end,
+    const float origin[3], const float dir[3], float * best_t, uint32_t * best_tri) {
+    vec4 o[3] = {v4_set(origin[0]), v4_set(origin[1]), v4_set(origin[2])};
+    vec4 d[3] = {v4_set(dir[0]), v4_set(dir[1]), v4_set(dir[2])};
+    vec4 zero = v4_set(0.0f);
+    vec4 one = v4_set(1.0f);
+    vec4 eps = v4_set(1e-12f);
+    bool found = false;
+
+    for (uint32_t i = start; i < end; i += 4) {
+        vec4 v0[3], e1[3], e2[3];
+        vec4 mask = load_tris(part, i, end, v0, e1, e2, NULL);
+
+        vec4 p[3], s[3], q[3];
+        v4_cross(p, d, e2);
+        vec4 det = v4_dot(e1, p);
+        mask = v4_and(mask, v4_lt(eps, v4_abs(det)));
+        vec4 inv = v4_div(one, det);
+
+        for (int a = 0; a < 3; a++) s[a] = v4_sub(o[a], v0[a]);
+        vec4 u = v4_mul(v4_dot(s, p), inv);
+        v4_cross(q, s, e1);
+        vec4 v = v4_mul(v4_dot(d, q), inv);
+        vec4 t = v4_mul(v4_dot(e2, q), inv);
+
+        mask = v4_and(mask, v4_le(zero, u));
+        mask = v4_and(mask, v4_le(zero, v));
+        mask = v4_and(mask, v4_le(v4_add(u, v), one));
+        mask = v4_and(mask, v4_le(zero, t));
+        mask = v4_and(mask, v4_lt(t, v4_set(*best_t)));
+
+        int bits = v4_mask(mask);
+        if (!bits) continue;
+
+        float ts[4];
+        v4_store(ts, t);
+        for (int l = 0; l < 4; l++) {
+            if ((bits >> l & 1) && ts[l] < *best_t) {
+                *best_t = ts[l];
+                *best_tri = i + l;
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
+bool hbx_raycast(const struct hbx * hbx, const float origin[3], const float dir[3], float max_t,
+    struct hbx_hit * hit) {
+    float inv_dir[3] = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+    float best_t = max_t;
+    bool found = false;
+
+    for (uint32_t p = 0; p < hbx->part_count; p++) {
+        const struct hbx_part * part = hbx->parts + p;
+        uint32_t best_tri = 0;
+        bool part_found = false;
+
+        for (uint32_t ni = next_leaf_ray(part, 0, origin, inv_dir, 0.0f, best_t); ni < part->node_count;
+            ni = next_leaf_ray(part, ni + 1, origin, inv_dir, 0.0f, best_t)) {
+            uint32_t first = part->node_first[ni] * 2;
+            uint32_t end = first + part->node_count_quads[ni] * 2;
+            part_found |= raycast_part(part, first, end, origin, dir, &best_t, &best_tri);
+        }
+
+        if (part_found) {
+            fill_hit(part, p, best_tri, best_t, dir, hit);
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// First time a sphere moving from origin along dir touches the segment a-b
+static bool sweep_edge(const float origin[3], const float dir[3], const float a[3], const float b[3],
+    float radius, float * t, float normal[3]) {
+    float ba[3], oa[3];
+    for (int i = 0; i < 3; i++) {
+        ba[i] = b[i] - a[i];
+        oa[i] = origin[i] - a[i];
+    }
+
+    float baba = dot3(ba, ba);
+    float bard = dot3(ba, dir);
+    float baoa = dot3(ba, oa);
+    float rdoa = dot3(dir, oa);
+    float oaoa = dot3(oa, oa);
+    float rr = radius * radius;
+    float best = INFINITY;
+
+    // Side of the capsule
+    float k2 = baba - bard * bard;
+    float k1 = baba * rdoa - baoa * bard;
+    float k0 = baba * oaoa - baoa * baoa - rr * baba;
+    float h = k1 * k1 - k2 * k0;
+    if (k2 > 1e-12f && h >= 0.0f) {
+        float tc = (-k1 - sqrtf(h)) / k2;
+        float y = baoa + tc * bard;
+        if (y > 0.0f && y < baba) best = fmaxf(tc, 0.0f);
+        if (k0 <= 0.0f && baoa > 0.0f && baoa < baba) best = 0.0f; // Starts inside
+    }
+
+    // Spheres at both ends
+    const float * ends[2] = {a, b};
+    for (int e = 0; e < 2; e++) {
+        float oc[3] = {origin[0] - ends[e][0], origin[1] - ends[e][1], origin[2] - ends[e][2]};
+        float hb = dot3(dir, oc);
+        float c = dot3(oc, oc) - rr;
+        float hs = hb * hb - c;
+        if (c <= 0.0f) best = 0.0f;
+        else if (hs >= 0.0f && hb < 0.0f) best = fminf(best, -hb - sqrtf(hs));
+    }
+
+    if (best >= *t) return false;
+    *t = best;
+
+    // Normal points from the closest point on the edge to the sphere center
+    float center[3], closest[3];
+    for (int i = 0; i < 3; i++) center[i] = origin[i] + dir[i] * best;
+    float f = baba > 0.0f ? (dot3(ba, center) - dot3(ba, a)) / baba : 0.0f;
+    f = fminf(fmaxf(f, 0.0f), 1.0f);
+    for (int i = 0; i < 3; i++) {
+        closest[i] = a[i] + ba[i] * f;
+        normal[i] = center[i] - closest[i];
+    }
+    float len = sqrtf(dot3(normal, normal));
+    for (int i = 0; i < 3; i++) normal[i] = len > 0.0f ? normal[i] / len : -dir[i];
+
+    return true;
+}
+
+/*
+ * Faces are tested four at a time by moving the sphere until it touches the plane of each triangle
+ * and checking if the contact point lies inside. Only triangles whose plane is reached but whose
+ * face is missed fall back to the scalar edge tests.
+ */
+static bool sweep_part(const struct hbx_part * part, uint32_t start, uint32_t end,
+    const float origin[3], const float dir[3], float radius, float * best_t, uint32_t * best_tri,
+    float best_normal[3]) {
+    vec4 o[3] = {v4_set(origin[0]), v4_set(origin[1]), v4_set(origin[2])};
+    vec4 d[3] = {v4_set(dir[0]), v4_set(dir[1]), v4_set(dir[2])};
+    vec4 zero = v4_set(0.0f);
+    vec4 one = v4_set(1.0f);
+    vec4 r = v4_set(radius);
+    bool found = false;
+
+    for (uint32_t i = start; i < end; i += 4) {
+        vec4 v0[3], e1[3], e2[3], n[3];
+        vec4 mask = load_tris(part, i, end, v0, e1, e2, n);
+
+        vec4 s[3];
+        for (int a = 0; a < 3; a++) s[a] = v4_sub(o[a], v0[a]);
+        vec4 dist = v4_dot(s, n);
+        vec4 dn = v4_dot(d, n);
+
+        // Work from the side of the plane the sphere starts on
+        vec4 below = v4_lt(dist, zero);
+        vec4 speed = v4_select(below, dn, v4_sub(zero, dn));
+        dist = v4_abs(dist);
+
+        // Time the sphere touches the plane, right away if it already does
+        vec4 touching = v4_le(dist, r);
+        vec4 reach = v4_or(touching, v4_lt(zero, speed));
+        vec4 t = v4_select(touching, zero, v4_div(v4_sub(dist, r), speed));
+        mask = v4_and(mask, reach);
+        mask = v4_and(mask, v4_lt(t, v4_set(*best_t)));
+        if (!v4_mask(mask)) continue;
+
+        // Project the center at that time onto the plane and find its barycentric coordinates
+        vec4 c[3], w[3];
+        for (int a = 0; a < 3; a++) c[a] = v4_add(s[a], v4_mul(d[a], t));
+        vec4 cd = v4_dot(c, n);
+        for (int a = 0; a < 3; a++) w[a] = v4_sub(c[a], v4_mul(n[a], cd));
+
+        vec4 d00 = v4_dot(e1, e1);
+        vec4 d01 = v4_dot(e1, e2);
+        vec4 d11 = v4_dot(e2, e2);
+        vec4 d20 = v4_dot(w, e1);
+        vec4 d21 = v4_dot(w, e2);
+        vec4 denom = v4_sub(v4_mul(d00, d11), v4_mul(d01, d01));
+        vec4 bv = v4_div(v4_sub(v4_mul(d11, d20), v4_mul(d01, d21)), denom);
+        vec4 bw = v4_div(v4_sub(v4_mul(d00, d21), v4_mul(d01, d20)), denom);
+
+        vec4 inside = v4_le(zero, bv);
+        inside = v4_and(inside, v4_le(zero, bw));
+        inside = v4_and(inside, v4_le(v4_add(bv, bw), one));
+
+        int face_bits = v4_mask(v4_and(mask, inside));
+        int edge_bits = v4_mask(v4_andnot(inside, mask));
+
+        float ts[4];
+        v4_store(ts, t);
+        for (int l = 0; l < 4; l++) {
+            uint32_t tri = i + l;
+
+            if ((face_bits >> l & 1) && ts[l] < *best_t) {
+                *best_t = ts[l];
+                *best_tri = tri;
+                for (int a = 0; a < 3; a++) best_normal[a] = part->n[a][tri];
+                if (dot3(best_normal, dir) > 0.0f) {
+                    for (int a = 0; a < 3; a++) best_normal[a] = -best_normal[a];
+                }
+                found = true;
+            } else if (edge_bits >> l & 1) {
+                float verts[3][3];
+                for (int a = 0; a < 3; a++) {
+                    verts[0][a] = part->v0[a][tri];
+                    verts[1][a] = verts[0][a] + part->e1[a][tri];
+                    verts[2][a] = verts[0][a] + part->e2[a][tri];
+                }
+                for (int e = 0; e < 3; e++) {
+                    if (sweep_edge(origin, dir, verts[e], verts[(e + 1) % 3], radius, best_t, best_normal)) {
+                        *best_tri = tri;
+                        found = true;
+                    }
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+bool hbx_sweep_sphere(const struct hbx * hbx, const float origin[3], const float dir[3], float radius,
+    float max_t, struct hbx_hit * hit) {
+    float inv_dir[3] = {1.0f / dir[0], 1.0f / dir[1], 1.0f / dir[2]};
+    float best_t = max_t;
+    bool found = false;
+
+    for (uint32_t p = 0; p < hbx->part_count; p++) {
+        const struct hbx_part * part = hbx->parts + p;
+        uint32_t best_tri = 0;
+        float normal[3];
+        bool part_found = false;
+
+        for (uint32_t ni = next_leaf_ray(part, 0, origin, inv_dir, radius, best_t); ni < part->node_count;
+            ni = next_leaf_ray(part, ni + 1, origin, inv_dir, radius, best_t)) {
+            uint32_t first = part->node_first[ni] * 2;
+            uint32_t end = first + part->node_count_quads[ni] * 2;
+            part_found |= sweep_part(part, first, end, origin, dir, radius, &best_t, &best_tri, normal);
+        }
+
+        if (part_found) {
+            fill_hit(part, p, best_tri, best_t, NULL, hit);
+            memcpy(hit->normal, normal, sizeof(normal));
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+// Separating axis test for one cross product of a triangle edge and a box axis
+static inline vec4 sat_edge(vec4 fa, vec4 fb, const vec4 va[3], const vec4 vb[3], float ha, float hb) {
+    vec4 p0 = v4_sub(v4_mul(fa, vb[0]), v4_mul(fb, va[0]));
+    vec4 p1 = v4_sub(v4_mul(fa, vb[1]), v4_mul(fb, va[1]));
+    vec4 p2 = v4_sub(v4_mul(fa, vb[2]), v4_mul(fb, va[2]));
+    vec4 r = v4_add(v4_mul(v4_set(ha), v4_abs(fb)), v4_mul(v4_set(hb), v4_abs(fa)));
+    vec4 lo = v4_min(p0, v4_min(p1, p2));
+    vec4 hi = v4_max(p0, v4_max(p1, p2));
+    return v4_or(v4_lt(r, lo), v4_lt(hi, v4_sub(v4_set(0.0f), r)));
+}
+
+static size_t overlap_part(const struct hbx_part * part, uint32_t p, uint32_t start, uint32_t end,
+    const float center[3], const float half[3], struct hbx_hit * hits, size_t max_hits, size_t found) {
+    vec4 zero = v4_set(0.0f);
+    uint32_t last_quad = UINT32_MAX;
+
+    for (uint32_t i = start; i < end; i += 4) {
+        vec4 v0[3], e1[3], e2[3], n[3];
+        vec4 mask = load_tris(part, i, end, v0, e1, e2, n);
+
+        // Vertices relative to the box center, stored per axis
+        vec4 v[3][3], f[3][3];
+        for (int a = 0; a < 3; a++) {
+            v[a][0] = v4_sub(v0[a], v4_set(center[a]));
+            v[a][1] = v4_add(v[a][0], e1[a]);
+            v[a][2] = v4_add(v[a][0], e2[a]);
+            f[0][a] = e1[a];
+            f[1][a] = v4_sub(e2[a], e1[a]);
+            f[2][a] = v4_sub(zero, e2[a]);
+        }
+
+        // Box axes
+        vec4 separated = zero;
+        for (int a = 0; a < 3; a++) {
+            vec4 h = v4_set(half[a]);
+            vec4 lo = v4_min(v[a][0], v4_min(v[a][1], v[a][2]));
+            vec4 hi = v4_max(v[a][0], v4_max(v[a][1], v[a][2]));
+            separated = v4_or(separated, v4_or(v4_lt(h, lo), v4_lt(hi, v4_sub(zero, h))));
+        }
+
+        // Triangle plane
+        vec4 dist = v4_abs(v4_add(v4_add(v4_mul(n[0], v[0][0]), v4_mul(n[1], v[1][0])), v4_mul(n[2], v[2][0])));
+        vec4 extent = v4_add(v4_add(v4_mul(v4_set(half[0]), v4_abs(n[0])), v4_mul(v4_set(half[1]), v4_abs(n[1]))),
+            v4_mul(v4_set(half[2]), v4_abs(n[2])));
+        separated = v4_or(separated, v4_lt(extent, dist));
+
+        // Edge cross box axes
+        for (int e = 0; e < 3; e++) {
+            separated = v4_or(separated, sat_edge(f[e][1], f[e][2], v[1], v[2], half[1], half[2]));
+            separated = v4_or(separated, sat_edge(f[e][2], f[e][0], v[2], v[0], half[2], half[0]));
+            separated = v4_or(separated, sat_edge(f[e][0], f[e][1], v[0], v[1], half[0], half[1]));
+        }
+
+        int bits = v4_mask(v4_andnot(separated, mask));
+        for (int l = 0; l < 4; l++) {
+            if (!(bits >> l & 1)) continue;
+
+            // Both triangles of a quad only count once
+            uint32_t tri = i + l;
+            if (tri / 2 == last_quad) continue;
+            last_quad = tri / 2;
+
+            if (found < max_hits) fill_hit(part, p, tri, 0.0f, NULL, hits + found);
+            found++;
+        }
+    }
+
+    return found;
+}
+
+size_t hbx_overlap_aabb(const struct hbx * hbx, const float min[3], const float max[3],
+    struct hbx_hit * hits, size_t max_hits) {
+    float center[3], half[3];
+    for (int a = 0; a < 3; a++) {
+        center[a] = (min[a] + max[a]) * 0.5f;
+        half[a] = (max[a] - min[a]) * 0.5f;
+    }
+
+    size_t found = 0;
+    for (uint32_t p = 0; p < hbx->part_count; p++) {
+        const struct hbx_part * part = hbx->parts + p;
+
+        for (uint32_t ni = next_leaf_box(part, 0, min, max); ni < part->node_count;
+            ni = next_leaf_box(part, ni + 1, min, max)) {
+            uint32_t first = part->node_first[ni] * 2;
+            uint32_t end = first + part->node_count_quads[ni] * 2;
+            found = overlap_part(part, p, first, end, center, half, hits, max_hits, found);
+        }
+    }
+
+    return found;
+}
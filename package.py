@@ -522,22 +522,22 @@ def main(root_path, godot_path):
         gltf_path = os.path.join(BIN_PATHS["MODEL"], f"{gltf:04}.gltf")
         
         print("Adding motion file:", lmt_path, "To glTF file:", gltf_path)
-        ret = subprocess.run([tool_path("sbmotion"), lmt_path, gltf_path])
-        if res.returncode != 0: return 1
-
-    # Convert Hitboxes
-    for hbxid in range(0, 251):
-        if hbxid == 180: continue # VT05
-        if hbxid > 207 and hbxid < 211: continue # VT33 - VT35
-        
-        hbx_path = os.path.join(BIN_PATHS["ATARI"], f"{hbxid:04}.ppd")
-
-        gltf = hbx_to_gltf(hbxid)
-        gltf_path = os.path.join(BIN_PATHS["MODEL"], f"{gltf:04}.gltf")
+        ret = subprocess.run([tool_path("sbmotion"), lmt_path, gltf_path, "--vat"])
+        if ret.returncode != 0: return 1
+
+    # Convert Hitboxes, all at once straight from the binary
+    hbx_map_path = os.path.join(BIN_PATHS["ATARI"], "hitboxes.txt")
+    with open(hbx_map_path, "w") as hbx_map:
+        for hbxid in range(0, 251):
+            if hbxid == 180: continue # VT05
+            if hbxid > 207 and hbxid < 211: continue # VT33 - VT35
+            
+            hbx_map.write(f"{hbxid} {hbx_to_gltf(hbxid)}\n")
 
-        print("Converting hitbox:", hbx_path)
-        res = subprocess.run([tool_path("sbhitbox"), hbx_path, gltf_path])
-        if res.returncode != 0: return 1
+    print("Converting hitboxes:", BIN_PATHS["ATARI"] + ".bin")
+    res = subprocess.run([tool_path("sbhitbox"), "--batch", BIN_PATHS["ATARI"] + ".bin", hbx_map_path,
+        BIN_PATHS["MODEL"], BIN_PATHS["ATARI"]])
+    if res.returncode != 0: return 1
 
     # Convert Terrains
     for terr in os.listdir(TERRAIN_PATH):
@@ -545,14 +545,20 @@ def main(root_path, godot_path):
         terr_path = os.path.join(TERRAIN_PATH, terr)
         if ext == ".gnd":
             print("Converting terrain:", terr_path)
-            res = subprocess.run([tool_path("sbterrain"), "-u", terr_path])
+            res = subprocess.run([tool_path("sbterrain"), "-u", "-f", "r16g16f", terr_path])
+            if res.returncode != 0: return 1
+            res = subprocess.run([tool_path("sbterrain"), "-l", terr_path])
+            if res.returncode != 0: return 1
+            res = subprocess.run([tool_path("sbterrain"), "-n", terr_path])
+            if res.returncode != 0: return 1
+            res = subprocess.run([tool_path("sbterrain"), "-t", terr_path])
             if res.returncode != 0: return 1
         elif ext == ".raw":
             print("Converting water bumpmap:", terr_path)
             res = subprocess.run([tool_path("sbterrain"), "-x", terr_path])
             if res.returncode != 0: return 1
 
-    # Convert sounds
+    # Convert sounds, 5.1 tracks are mixed down to stereo until Godot supports surround WAVs
     res = subprocess.run([tool_path("sbsound"), os.path.join(SOUND_PATH, "Bank.xsb")])
     if res.returncode != 0: return 1
     
@@ -574,18 +580,6 @@ def main(root_path, godot_path):
                 sound_base += ".ogg"
                 res = subprocess.run([ffmpeg_path, "-y", "-i", sound_path, "-acodec", "libvorbis", sound_base])
                 if res.returncode != 0: return 1
-            elif ext == ".xwav":
-                print("Converting sound to PCM WAV:", sound_path)
-                sound_base += ".wav"
-                res = subprocess.run([ffmpeg_path, "-y", "-i", sound_path, "-f", "wav", sound_base])
-                if res.returncode != 0: return 1
-            elif os.path.basename(sound_base).startswith("STRM"):
-                # TODO: Get rid of this once Godot supports 5.1 surround WAVs
-                print("Converting sound to Stereo PCM WAV:", sound_path);
-                sound_base += ".wav"
-                res = subprocess.run([ffmpeg_path, "-y", "-i", sound_path, "-ac", "2", "-f", "wav", "temp.wav"])
-                os.replace("temp.wav", sound_base)
-                if res.returncode != 0: return 1
 
     # Extract sound data from engine
     res = subprocess.run([tool_path("sbsound"), os.path.join(XBE_PATH, ".data.seg")])
@@ -677,6 +671,22 @@ def main(root_path, godot_path):
             os.replace(os.path.join(TERRAIN_PATH, mapid + ".dds"), os.path.join(mission_path, "height.dds"))
         except FileNotFoundError:
             pass
+        
+        try:
+            os.replace(os.path.join(TERRAIN_PATH, mapid + ".cdl"), os.path.join(mission_path, "terrain.cdl"))
+        except FileNotFoundError:
+            pass
+        
+        try:
+            os.replace(os.path.join(TERRAIN_PATH, mapid + "_normal.dds"), os.path.join(mission_path, "normal.dds"))
+            os.replace(os.path.join(TERRAIN_PATH, mapid + "_slope.dds"), os.path.join(mission_path, "slope.dds"))
+        except FileNotFoundError:
+            pass
+        
+        try:
+            os.replace(os.path.join(TERRAIN_PATH, mapid + ".tpk"), os.path.join(mission_path, "terrain.tpk"))
+        except FileNotFoundError:
+            pass
 
         objtex = i + 157
         os.replace(os.path.join(BIN_PATHS["TEXTURE"], f"{objtex:04}.dds"), os.path.join(mission_path, "object.dds"))
@@ -711,10 +721,11 @@ def main(root_path, godot_path):
         except FileNotFoundError:
             pass
             
-        res = subprocess.run([tool_path("sbstage"), str(i), STAGE_PATH])
+        res = subprocess.run([tool_path("sbstage"), str(i), STAGE_PATH, "--instances"])
         if res.returncode != 0: return 1
 
         os.replace(os.path.join(STAGE_PATH, mapid + ".json"), os.path.join(mission_path, "config.json"))
+        os.replace(os.path.join(STAGE_PATH, mapid + ".bin"), os.path.join(mission_path, "instances.bin"))
 
     # Copy map terrain factors
     res = subprocess.run([tool_path("sbstage"), "data", STAGE_PATH])
@@ -730,6 +741,11 @@ def main(root_path, godot_path):
         os.replace(os.path.join(BIN_PATHS["MODEL"], f"{i:04}.gltf"), os.path.join(mapobj_path, f"{i:04}.gltf"))
         os.replace(os.path.join(BIN_PATHS["MODEL"], f"{i:04}.glbin"), os.path.join(mapobj_path, f"{i:04}.glbin"))
         
+        # Animated objects also have baked vertex animation textures
+        for vat in [f"{i:04}_vat_pos.dds", f"{i:04}_vat_norm.dds"]:
+            if os.path.exists(os.path.join(BIN_PATHS["MODEL"], vat)):
+                os.replace(os.path.join(BIN_PATHS["MODEL"], vat), os.path.join(mapobj_path, vat))
+        
         if i in LSQ_TO_GLTF:
             lsqid = LSQ_TO_GLTF.index(i) + 13
             os.replace(os.path.join(BIN_PATHS["LSQ"], f"{lsqid:04}.json"), os.path.join(mapobj_path, f"lsq{i:04}.json"))
@@ -0,0 +1,263 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+
+#include "hbx.h"
+
+#define CHECK_RAYS_MAX 20000
+
+char * progname;
+size_t ray_count = 1000000;
+float sweep_radius = 0.5f;
+uint32_t seed = 1;
+bool check = false;
+
+struct ray {
+    float origin[3];
+    float dir[3];
+    float max_t;
+};
+
+// Small xorshift so every platform sees the same rays for the same seed
+static inline float random_float(float min, float max) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return min + (max - min) * (seed >> 8) * (1.0f / 16777216.0f);
+}
+
+static void hbx_bounds(const struct hbx * hbx, float min[3], float max[3]) {
+    for (int a = 0; a < 3; a++) {
+        min[a] = INFINITY;
+        max[a] = -INFINITY;
+    }
+    for (uint32_t p = 0; p < hbx->part_count; p++) {
+        const struct hbx_part * part = hbx->parts + p;
+        if (!part->node_count || !part->tri_count) continue;
+        for (int a = 0; a < 3; a++) {
+            min[a] = fminf(min[a], part->node_min[a][0]);
+            max[a] = fmaxf(max[a], part->node_max[a][0]);
+        }
+    }
+}
+
+// Rays start on a sphere around the hitbox and aim at a random point inside its bounds
+static void random_rays(struct ray * rays, size_t count, const float min[3], const float max[3]) {
+    float center[3], extent = 0.0f;
+    for (int a = 0; a < 3; a++) {
+        center[a] = (min[a] + max[a]) * 0.5f;
+        extent += (max[a] - min[a]) * (max[a] - min[a]);
+    }
+    float radius = sqrtf(extent) + 1.0f;
+
+    for (size_t i = 0; i < count; i++) {
+        float dir[3], len;
+        do {
+            for (int a = 0; a < 3; a++) dir[a] = random_float(-1.0f, 1.0f);
+            len = sqrtf(dir[0] * dir[0] + dir[1] * dir[1] + dir[2] * dir[2]);
+        } while (len < 0.01f || len > 1.0f);
+
+        len = 0.0f;
+        for (int a = 0; a < 3; a++) {
+            rays[i].origin[a] = center[a] + dir[a] * radius;
+            rays[i].dir[a] = random_float(min[a], max[a]) - rays[i].origin[a];
+            len += rays[i].dir[a] * rays[i].dir[a];
+        }
+        len = sqrtf(len);
+        for (int a = 0; a < 3; a++) rays[i].dir[a] /= len;
+        rays[i].max_t = radius * 2.0f;
+    }
+}
+
+// Every triangle one by one without the hierarchy, only used to check the results
+static bool brute_raycast(const struct hbx * hbx, const struct ray * ray, float * best_t) {
+    bool found = false;
+    *best_t = ray->max_t;
+
+    for (uint32_t p = 0; p < hbx->part_count; p++) {
+        const struct hbx_part * part = hbx->parts + p;
+        for (uint32_t t = 0; t < part->tri_count; t++) {
+            float e1[3], e2[3], s[3], pv[3], q[3];
+            for (int a = 0; a < 3; a++) {
+                e1[a] = part->e1[a][t];
+                e2[a] = part->e2[a][t];
+                s[a] = ray->origin[a] - part->v0[a][t];
+            }
+            pv[0] = ray->dir[1] * e2[2] - ray->dir[2] * e2[1];
+            pv[1] = ray->dir[2] * e2[0] - ray->dir[0] * e2[2];
+            pv[2] = ray->dir[0] * e2[1] - ray->dir[1] * e2[0];
+            double det = e1[0] * pv[0] + e1[1] * pv[1] + e1[2] * pv[2];
+            if (fabs(det) < 1e-12) continue;
+
+            q[0] = s[1] * e1[2] - s[2] * e1[1];
+            q[1] = s[2] * e1[0] - s[0] * e1[2];
+            q[2] = s[0] * e1[1] - s[1] * e1[0];
+            double u = (s[0] * pv[0] + s[1] * pv[1] + s[2] * pv[2]) / det;
+            double v = (ray->dir[0] * q[0] + ray->dir[1] * q[1] + ray->dir[2] * q[2]) / det;
+            double d = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+            if (u < 0 || v < 0 || u + v > 1 || d < 0 || d >= *best_t) continue;
+
+            *best_t = d;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+static double seconds(clock_t start) {
+    return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+int main(int argc, char ** argv) {
+    progname = *argv++; argc--;
+
+    printf("SB Hitbox Query Benchmark - By QuantX\n");
+
+    char ** paths = calloc(argc + 1, sizeof(char *));
+    size_t path_count = 0;
+
+    while (argc) {
+        char * arg = *argv++; argc--;
+
+        if (!strcmp(arg, "--rays") && argc) {
+            ray_count = strtoul(*argv++, NULL, 10); argc--;
+        } else if (!strcmp(arg, "--radius") && argc) {
+            sweep_radius = atof(*argv++); argc--;
+        } else if (!strcmp(arg, "--seed") && argc) {
+            seed = strtoul(*argv++, NULL, 10); argc--;
+            if (!seed) seed = 1;
+        } else if (!strcmp(arg, "--check")) {
+            check = true;
+        } else if (!strncmp(arg, "--", 2)) {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return 1;
+        } else {
+            paths[path_count++] = arg;
+        }
+    }
+
+    if (!path_count || !ray_count) {
+        fprintf(stderr, "Usage: %s <hitbox.hbx> ... (--rays <count>) (--radius <sweep radius>) (--seed <n>) (--check)\n",
+            progname);
+        return 1;
+    }
+
+    struct hbx ** hbxs = calloc(path_count, sizeof(struct hbx *));
+    size_t tri_total = 0, node_total = 0;
+
+    for (size_t i = 0; i < path_count; i++) {
+        hbxs[i] = hbx_load(paths[i]);
+        if (!hbxs[i]) {
+            fprintf(stderr, "Failed to load hitbox: %s\n", paths[i]);
+            return 1;
+        }
+        for (uint32_t p = 0; p < hbxs[i]->part_count; p++) {
+            tri_total += hbxs[i]->parts[p].tri_count;
+            node_total += hbxs[i]->parts[p].node_count;
+        }
+    }
+
+    printf("Loaded %lu hitboxes, %lu triangles, %lu BVH nodes\n", path_count, tri_total, node_total);
+
+    // The rays are spread evenly over the hitboxes and generated up front so only queries are timed
+    size_t per_file = (ray_count + path_count - 1) / path_count;
+    struct ray * rays = malloc(per_file * sizeof(struct ray));
+
+    size_t box_per_file = per_file / 10 + 1;
+    float (* boxes)[2][3] = malloc(box_per_file * sizeof(*boxes));
+    struct hbx_hit overlaps[64];
+
+    double ray_time = 0.0, sweep_time = 0.0, box_time = 0.0;
+    size_t rays_done = 0, ray_hits = 0, sweep_hits = 0, boxes_done = 0, box_hits = 0;
+    size_t checked = 0, mismatches = 0, sweep_errors = 0;
+
+    for (size_t i = 0; i < path_count; i++) {
+        const struct hbx * hbx = hbxs[i];
+
+        float min[3], max[3];
+        hbx_bounds(hbx, min, max);
+        if (min[0] > max[0]) continue;
+
+        random_rays(rays, per_file, min, max);
+
+        for (size_t b = 0; b < box_per_file; b++) {
+            for (int a = 0; a < 3; a++) {
+                float c = random_float(min[a], max[a]);
+                boxes[b][0][a] = c - sweep_radius;
+                boxes[b][1][a] = c + sweep_radius;
+            }
+        }
+
+        struct hbx_hit hit;
+        clock_t start = clock();
+        for (size_t r = 0; r < per_file; r++) {
+            ray_hits += hbx_raycast(hbx, rays[r].origin, rays[r].dir, rays[r].max_t, &hit);
+        }
+        ray_time += seconds(start);
+
+        start = clock();
+        for (size_t r = 0; r < per_file; r++) {
+            sweep_hits += hbx_sweep_sphere(hbx, rays[r].origin, rays[r].dir, sweep_radius, rays[r].max_t, &hit);
+        }
+        sweep_time += seconds(start);
+
+        start = clock();
+        for (size_t b = 0; b < box_per_file; b++) {
+            box_hits += hbx_overlap_aabb(hbx, boxes[b][0], boxes[b][1], overlaps, 64) != 0;
+        }
+        box_time += seconds(start);
+
+        rays_done += per_file;
+        boxes_done += box_per_file;
+
+        if (!check) continue;
+
+        size_t check_count = CHECK_RAYS_MAX / path_count + 1;
+        if (check_count > per_file) check_count = per_file;
+
+        for (size_t r = 0; r < check_count; r++) {
+            float brute_t;
+            struct hbx_hit sweep;
+            bool brute = brute_raycast(hbx, rays + r, &brute_t);
+            bool found = hbx_raycast(hbx, rays[r].origin, rays[r].dir, rays[r].max_t, &hit);
+            bool swept = hbx_sweep_sphere(hbx, rays[r].origin, rays[r].dir, sweep_radius, rays[r].max_t, &sweep);
+
+            if (brute != found || (found && fabsf(brute_t - hit.t) > 1e-3f * fmaxf(1.0f, brute_t))) {
+                if (mismatches < 10) {
+                    printf("Ray mismatch in %s: %s %f, brute force %s %f\n", paths[i],
+                        found ? "hit" : "miss", found ? hit.t : 0.0f, brute ? "hit" : "miss", brute ? brute_t : 0.0f);
+                }
+                mismatches++;
+            }
+
+            // A sphere following the ray has to touch something no later than the ray does
+            if (found && (!swept || sweep.t > hit.t + 1e-3f)) sweep_errors++;
+            checked++;
+        }
+    }
+
+    printf("Rays:   %lu in %.3fs, %.0f queries/s, %.1f%% hit\n", rays_done, ray_time,
+        rays_done / fmax(ray_time, 1e-9), 100.0 * ray_hits / rays_done);
+    printf("Sweeps: %lu in %.3fs, %.0f queries/s, %.1f%% hit, radius %f\n", rays_done, sweep_time,
+        rays_done / fmax(sweep_time, 1e-9), 100.0 * sweep_hits / rays_done, sweep_radius);
+    printf("Boxes:  %lu in %.3fs, %.0f queries/s, %.1f%% hit\n", boxes_done, box_time,
+        boxes_done / fmax(box_time, 1e-9), 100.0 * box_hits / boxes_done);
+
+    if (check) {
+        printf("Checked %lu rays against brute force: %lu ray mismatches, %lu sweeps behind the ray\n",
+            checked, mismatches, sweep_errors);
+    }
+
+    for (size_t i = 0; i < path_count; i++) hbx_free(hbxs[i]);
+    free(hbxs);
+    free(paths);
+    free(rays);
+    free(boxes);
+
+    return check && (mismatches || sweep_errors);
+}
@@ -24,7 +24,6 @@ struct atari_header {
     uint32_t data_index;
 } __attribute__((__packed__));
 
-#define ATARI_DATA_COUNT_MAX 4000
 struct atari_data {
     int32_t val;
     struct vector3 verts[4];
@@ -32,14 +31,46 @@ struct atari_data {
     uint64_t flags;
     struct vector3 norm;
     uint32_t zero1;
-} __attribute__((__packed__)) atari_data_list[ATARI_DATA_COUNT_MAX];
+} __attribute__((__packed__));
+
+// Quads of the part being processed, grown as needed and reused for every part
+struct atari_data * atari_data_list = NULL;
 size_t atari_data_count = 0;
+size_t atari_data_capacity = 0;
+
+/*
+ * The PPD header tree is kept as a flattened BVH in depth first order. Each node covers the quads
+ * of its whole subtree, skip is the node to continue with when the subtree is missed and a node is
+ * a leaf when skip points at the very next node.
+ */
+struct bvh_node {
+    float min[3], max[3];
+    uint32_t skip;
+    uint32_t first; // First quad of the subtree within the part
+    uint32_t count;
+};
+
+struct bvh_node * bvh_nodes = NULL;
+size_t bvh_node_count = 0;
+size_t bvh_node_capacity = 0;
+
+// Parsed glTF files, several hitboxes can share one model in batch mode
+struct gltf_entry {
+    char * path;
+    cgltf_data * data;
+};
+
+struct gltf_entry * gltf_cache = NULL;
+size_t gltf_cache_count = 0;
 
 char * progname;
 char out_path[256];
 char * ppd_path;
 char * gltf_path;
 
+long ppd_base = 0; // Start of the PPD within the opened file
+bool verbose = true;
+
 const float scale_factor = 100.0f;
 
 static inline size_t write_vec3(struct vector3 v, FILE * f) {
@@ -53,6 +84,13 @@ int process_header(FILE * ppd, unsigned int level) {
         struct atari_header header;
         fread(&header, sizeof(struct atari_header), 1, ppd);
         
+        if (bvh_node_count == bvh_node_capacity) {
+            bvh_node_capacity = bvh_node_capacity ? bvh_node_capacity * 2 : 64;
+            bvh_nodes = realloc(bvh_nodes, bvh_node_capacity * sizeof(struct bvh_node));
+        }
+        size_t node_index = bvh_node_count++;
+        size_t quad_start = atari_data_count;
+        
         struct vector3 center = {header.center[0], header.center[1], header.center[2]};
         center.x /= scale_factor;
         center.y /= scale_factor;
@@ -63,15 +101,17 @@ int process_header(FILE * ppd, unsigned int level) {
         extents.y /= scale_factor;
         extents.z /= scale_factor;
         
-        printf("%*sAABB-START (%f, %f, %f)\n", level, "",
-            center.x - extents.x, center.y - extents.y, center.z - extents.z);
-        printf("%*sAABB-END   (%f, %f, %f)\n", level, "",
-            center.x + extents.x, center.y + extents.y, center.z + extents.z);
-        
-        printf("%*sSub Header Count %u\n", level, "", header.sub_header_count);
-        printf("%*sNext Header Offset %u\n", level, "", header.next_header_offset);
-        printf("%*sData Index %u\n", level, "", header.data_index);
-        printf("%*sData Count %u\n", level, "", header.data_count);
+        if (verbose) {
+            printf("%*sAABB-START (%f, %f, %f)\n", level, "",
+                center.x - extents.x, center.y - extents.y, center.z - extents.z);
+            printf("%*sAABB-END   (%f, %f, %f)\n", level, "",
+                center.x + extents.x, center.y + extents.y, center.z + extents.z);
+            
+            printf("%*sSub Header Count %u\n", level, "", header.sub_header_count);
+            printf("%*sNext Header Offset %u\n", level, "", header.next_header_offset);
+            printf("%*sData Index %u\n", level, "", header.data_index);
+            printf("%*sData Count %u\n", level, "", header.data_count);
+        }
         
         if (header.zero) {
             fprintf(stderr, "Header entry \"zero\" was non-zero: %08X\n", header.zero);
@@ -81,9 +121,11 @@ int process_header(FILE * ppd, unsigned int level) {
         if (header.sub_header_count) {
             if (process_header(ppd, level + 2)) return 1;
         } else {
-            if (atari_data_count + header.data_count >= ATARI_DATA_COUNT_MAX) {
-                fprintf(stderr, "Atari data overflow\n");
-                return 1;
+            if (atari_data_count + header.data_count > atari_data_capacity) {
+                while (atari_data_count + header.data_count > atari_data_capacity) {
+                    atari_data_capacity = atari_data_capacity ? atari_data_capacity * 2 : 256;
+                }
+                atari_data_list = realloc(atari_data_list, atari_data_capacity * sizeof(struct atari_data));
             }
             
             struct atari_data * data = atari_data_list + atari_data_count;
@@ -102,14 +144,18 @@ int process_header(FILE * ppd, unsigned int level) {
                     data[di].verts[i].y /= scale_factor;
                     data[di].verts[i].z /= scale_factor;
                     
-                    printf("%*sPOS%d (%f, %f, %f)\n", level + 2, "",
-                        i, data[di].verts[i].x, data[di].verts[i].y, data[di].verts[i].z);
+                    if (verbose) {
+                        printf("%*sPOS%d (%f, %f, %f)\n", level + 2, "",
+                            i, data[di].verts[i].x, data[di].verts[i].y, data[di].verts[i].z);
+                    }
                 }
                 
-                printf("%*sFlags %16lX\n", level + 2, "", data[di].flags);
-                
-                printf("%*sNORM (%f, %f, %f)\n", level + 2, "",
-                    data[di].norm.x, data[di].norm.y, data[di].norm.z);
+                if (verbose) {
+                    printf("%*sFlags %16lX\n", level + 2, "", data[di].flags);
+                    
+                    printf("%*sNORM (%f, %f, %f)\n", level + 2, "",
+                        data[di].norm.x, data[di].norm.y, data[di].norm.z);
+                }
                 
                 if (data[di].val != -1) {
                     fprintf(stderr, "Data entry \"val\" was not -1: %d\n", data[di].val);
@@ -128,48 +174,405 @@ int process_header(FILE * ppd, unsigned int level) {
             }
         }
 
+        // The original box is grown to the quads in case it was built for slightly different data
+        struct bvh_node * node = bvh_nodes + node_index;
+        node->min[0] = center.x - extents.x;
+        node->min[1] = center.y - extents.y;
+        node->min[2] = center.z - extents.z;
+        node->max[0] = center.x + extents.x;
+        node->max[1] = center.y + extents.y;
+        node->max[2] = center.z + extents.z;
+        
+        for (size_t di = quad_start; di < atari_data_count; di++) {
+            for (int i = 0; i < 4; i++) {
+                struct vector3 v = atari_data_list[di].verts[i];
+                node->min[0] = fminf(node->min[0], v.x);
+                node->min[1] = fminf(node->min[1], v.y);
+                node->min[2] = fminf(node->min[2], v.z);
+                node->max[0] = fmaxf(node->max[0], v.x);
+                node->max[1] = fmaxf(node->max[1], v.y);
+                node->max[2] = fmaxf(node->max[2], v.z);
+            }
+        }
+        
+        node->skip = bvh_node_count;
+        node->first = quad_start;
+        node->count = atari_data_count - quad_start;
+
         if (!header.next_header_offset) return 0;
         fseek(ppd, header_pos + header.next_header_offset, SEEK_SET);
     }
 }
 
-int main(int argc, char ** argv) {
-    progname = *argv++; argc--;
+/*
+ * Convex hulls are built incrementally from the quad corners of a part. Parts that fill their hull
+ * poorly are split at the median quad along their longest axis until every piece is good enough.
+ * The volume error of a hull is the share of its volume outside the part, estimated by sampling
+ * points in the hull and checking the winding number of the part's triangles around them.
+ */
+#define HULL_SAMPLES 1000
+#define HULL_DEPTH_MAX 3
 
-    printf("SB Hitbox Tool - By QuantX\n");
+struct hull_face {
+    uint32_t v[3];
+    float plane[4]; // Outward normal and distance
+    bool alive;
+};
 
-    if (argc < 2) {
-        fprintf(stderr, "Please specify a PPD file: %s <path/example.ppd> <path/example.gltf>\n", progname);
-        return 1;
+struct hull {
+    uint32_t part;
+    float error;
+    uint32_t vert_count;
+    struct vector3 * verts;
+    uint32_t face_count;
+    struct hull_face * faces;
+};
+
+float hull_error_max = -1.0f; // Negative when no hulls are wanted
+struct hull * hulls = NULL;
+size_t hull_count = 0;
+
+uint32_t hull_seed = 1;
+int split_axis = 0;
+
+static inline float vec3_axis(struct vector3 v, int axis) {
+    return axis == 0 ? v.x : axis == 1 ? v.y : v.z;
+}
+
+static inline struct vector3 vec3_sub(struct vector3 a, struct vector3 b) {
+    return (struct vector3){a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+static inline struct vector3 vec3_cross(struct vector3 a, struct vector3 b) {
+    return (struct vector3){a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x};
+}
+
+static inline float vec3_dot(struct vector3 a, struct vector3 b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+static inline float vec3_length(struct vector3 a) {
+    return sqrtf(vec3_dot(a, a));
+}
+
+static inline float plane_distance(const float plane[4], struct vector3 p) {
+    return plane[0] * p.x + plane[1] * p.y + plane[2] * p.z - plane[3];
+}
+
+static bool face_plane(struct hull_face * face, const struct vector3 * points) {
+    struct vector3 a = points[face->v[0]];
+    struct vector3 n = vec3_cross(vec3_sub(points[face->v[1]], a), vec3_sub(points[face->v[2]], a));
+    float len = vec3_length(n);
+    if (len <= 0.0f) return false;
+    
+    face->plane[0] = n.x / len;
+    face->plane[1] = n.y / len;
+    face->plane[2] = n.z / len;
+    face->plane[3] = (n.x * a.x + n.y * a.y + n.z * a.z) / len;
+    return true;
+}
+
+static void add_face(struct hull_face ** faces, size_t * count, const struct vector3 * points,
+    uint32_t a, uint32_t b, uint32_t c) {
+    *faces = realloc(*faces, (*count + 1) * sizeof(struct hull_face));
+    struct hull_face * face = *faces + (*count)++;
+    face->v[0] = a;
+    face->v[1] = b;
+    face->v[2] = c;
+    face->alive = face_plane(face, points);
+}
+
+// Returns the index of the point farthest from the result of measure
+#define FARTHEST(result, count, measure) do { \
+    float best = -1.0f; \
+    for (size_t pi = 0; pi < (count); pi++) { \
+        float d = (measure); \
+        if (d > best) { best = d; (result) = pi; } \
+    } \
+} while (0)
+
+bool build_hull(const struct vector3 * points, size_t count, struct hull * hull) {
+    if (count < 4) return false;
+    
+    struct vector3 min = points[0], max = points[0];
+    for (size_t i = 1; i < count; i++) {
+        min.x = fminf(min.x, points[i].x); max.x = fmaxf(max.x, points[i].x);
+        min.y = fminf(min.y, points[i].y); max.y = fmaxf(max.y, points[i].y);
+        min.z = fminf(min.z, points[i].z); max.z = fmaxf(max.z, points[i].z);
     }
+    float eps = vec3_length(vec3_sub(max, min)) * 1e-5f;
     
-    ppd_path = *argv++; argc--;
-    gltf_path = *argv++; argc--;
+    // Initial tetrahedron from points far apart from each other
+    size_t i0 = 0, i1 = 0, i2 = 0, i3 = 0;
+    FARTHEST(i0, count, -vec3_dot(points[pi], (struct vector3){1.0f, 1.0f, 1.0f}));
+    FARTHEST(i1, count, vec3_length(vec3_sub(points[pi], points[i0])));
+    struct vector3 axis = vec3_sub(points[i1], points[i0]);
+    FARTHEST(i2, count, vec3_length(vec3_cross(axis, vec3_sub(points[pi], points[i0]))));
+    struct vector3 normal = vec3_cross(axis, vec3_sub(points[i2], points[i0]));
+    float normal_len = vec3_length(normal);
+    if (normal_len <= eps * eps) return false;
+    FARTHEST(i3, count, fabsf(vec3_dot(normal, vec3_sub(points[pi], points[i0]))));
+    if (fabsf(vec3_dot(normal, vec3_sub(points[i3], points[i0]))) / normal_len <= eps) return false;
     
-    FILE * ppd = fopen(ppd_path, "rb");
-    if (!ppd) {
-        fprintf(stderr, "Failed to open PPD file: %s\n", ppd_path);
-        return 1;
+    if (vec3_dot(normal, vec3_sub(points[i3], points[i0])) > 0.0f) {
+        size_t swap = i1; i1 = i2; i2 = swap;
+    }
+    
+    struct hull_face * faces = NULL;
+    size_t face_count = 0;
+    add_face(&faces, &face_count, points, i0, i1, i2);
+    add_face(&faces, &face_count, points, i0, i3, i1);
+    add_face(&faces, &face_count, points, i1, i3, i2);
+    add_face(&faces, &face_count, points, i2, i3, i0);
+    
+    uint32_t * horizon = NULL;
+    size_t horizon_size = 0;
+    
+    for (size_t pi = 0; pi < count; pi++) {
+        if (pi == i0 || pi == i1 || pi == i2 || pi == i3) continue;
+        struct vector3 p = points[pi];
+        
+        size_t visible_count = 0;
+        for (size_t fi = 0; fi < face_count; fi++) {
+            if (faces[fi].alive && plane_distance(faces[fi].plane, p) > eps) visible_count++;
+        }
+        if (!visible_count) continue;
+        
+        // Edges of visible faces whose neighbour stays are the horizon
+        size_t horizon_count = 0;
+        for (size_t fi = 0; fi < face_count; fi++) {
+            if (!faces[fi].alive || plane_distance(faces[fi].plane, p) <= eps) continue;
+            
+            for (int e = 0; e < 3; e++) {
+                uint32_t a = faces[fi].v[e], b = faces[fi].v[(e + 1) % 3];
+                bool shared = false;
+                for (size_t fj = 0; fj < face_count && !shared; fj++) {
+                    if (!faces[fj].alive || fj == fi || plane_distance(faces[fj].plane, p) <= eps) continue;
+                    for (int ej = 0; ej < 3; ej++) {
+                        if (faces[fj].v[ej] == b && faces[fj].v[(ej + 1) % 3] == a) shared = true;
+                    }
+                }
+                if (shared) continue;
+                
+                if (horizon_count * 2 + 2 > horizon_size) {
+                    horizon_size = horizon_size ? horizon_size * 2 : 64;
+                    horizon = realloc(horizon, horizon_size * sizeof(uint32_t));
+                }
+                horizon[horizon_count * 2] = a;
+                horizon[horizon_count * 2 + 1] = b;
+                horizon_count++;
+            }
+        }
+        
+        for (size_t fi = 0; fi < face_count; fi++) {
+            if (faces[fi].alive && plane_distance(faces[fi].plane, p) > eps) faces[fi].alive = false;
+        }
+        for (size_t hi = 0; hi < horizon_count; hi++) {
+            add_face(&faces, &face_count, points, horizon[hi * 2], horizon[hi * 2 + 1], pi);
+        }
+        
+        // Drop dead faces once they make up most of the list
+        size_t alive = 0;
+        for (size_t fi = 0; fi < face_count; fi++) alive += faces[fi].alive;
+        if (alive * 2 < face_count) {
+            size_t out = 0;
+            for (size_t fi = 0; fi < face_count; fi++) {
+                if (faces[fi].alive) faces[out++] = faces[fi];
+            }
+            face_count = out;
+        }
+    }
+    
+    free(horizon);
+    
+    // Keep only the points and faces that made it into the hull
+    uint32_t * remap = malloc(count * sizeof(uint32_t));
+    memset(remap, 0xFF, count * sizeof(uint32_t));
+    
+    hull->vert_count = 0;
+    hull->face_count = 0;
+    hull->verts = malloc(count * sizeof(struct vector3));
+    hull->faces = malloc(face_count * sizeof(struct hull_face));
+    
+    for (size_t fi = 0; fi < face_count; fi++) {
+        if (!faces[fi].alive) continue;
+        
+        struct hull_face * face = hull->faces + hull->face_count++;
+        *face = faces[fi];
+        for (int i = 0; i < 3; i++) {
+            if (remap[face->v[i]] == UINT32_MAX) {
+                remap[face->v[i]] = hull->vert_count;
+                hull->verts[hull->vert_count++] = points[face->v[i]];
+            }
+            face->v[i] = remap[face->v[i]];
+        }
+    }
+    
+    free(remap);
+    free(faces);
+    
+    return true;
+}
+
+// Winding number of the part's triangles around p, close to +-1 inside a closed part and 0 outside
+float part_winding(struct vector3 p) {
+    float total = 0.0f;
+    
+    for (size_t di = 0; di < atari_data_count; di++) {
+        struct vector3 * verts = atari_data_list[di].verts;
+        const int tris[2][3] = {{1, 0, 2}, {3, 1, 2}};
+        
+        for (int t = 0; t < 2; t++) {
+            struct vector3 a = vec3_sub(verts[tris[t][0]], p);
+            struct vector3 b = vec3_sub(verts[tris[t][1]], p);
+            struct vector3 c = vec3_sub(verts[tris[t][2]], p);
+            float la = vec3_length(a), lb = vec3_length(b), lc = vec3_length(c);
+            
+            float det = vec3_dot(a, vec3_cross(b, c));
+            float div = la * lb * lc + vec3_dot(a, b) * lc + vec3_dot(a, c) * lb + vec3_dot(b, c) * la;
+            total += 2.0f * atan2f(det, div);
+        }
+    }
+    
+    return total / (4.0f * M_PI);
+}
+
+static inline float hull_random(float min, float max) {
+    hull_seed ^= hull_seed << 13;
+    hull_seed ^= hull_seed >> 17;
+    hull_seed ^= hull_seed << 5;
+    return min + (max - min) * (hull_seed >> 8) * (1.0f / 16777216.0f);
+}
+
+float hull_volume_error(const struct hull * hull) {
+    struct vector3 min = hull->verts[0], max = hull->verts[0];
+    for (uint32_t i = 1; i < hull->vert_count; i++) {
+        min.x = fminf(min.x, hull->verts[i].x); max.x = fmaxf(max.x, hull->verts[i].x);
+        min.y = fminf(min.y, hull->verts[i].y); max.y = fmaxf(max.y, hull->verts[i].y);
+        min.z = fminf(min.z, hull->verts[i].z); max.z = fmaxf(max.z, hull->verts[i].z);
+    }
+    
+    int samples = 0, outside = 0;
+    for (int attempt = 0; attempt < HULL_SAMPLES * 20 && samples < HULL_SAMPLES; attempt++) {
+        struct vector3 p = {hull_random(min.x, max.x), hull_random(min.y, max.y), hull_random(min.z, max.z)};
+        
+        bool inside = true;
+        for (uint32_t fi = 0; fi < hull->face_count && inside; fi++) {
+            if (plane_distance(hull->faces[fi].plane, p) > 0.0f) inside = false;
+        }
+        if (!inside) continue;
+        
+        samples++;
+        if (fabsf(part_winding(p)) < 0.5f) outside++;
+    }
+    
+    return samples ? (float)outside / samples : 1.0f;
+}
+
+int compare_split(const void * a, const void * b) {
+    const struct atari_data * qa = atari_data_list + *(const size_t *)a;
+    const struct atari_data * qb = atari_data_list + *(const size_t *)b;
+    float ca = 0.0f, cb = 0.0f;
+    for (int i = 0; i < 4; i++) {
+        ca += vec3_axis(qa->verts[i], split_axis);
+        cb += vec3_axis(qb->verts[i], split_axis);
+    }
+    return (ca > cb) - (ca < cb);
+}
+
+void add_hulls(uint32_t part, size_t * quads, size_t count, unsigned int depth) {
+    struct vector3 * points = malloc(count * 4 * sizeof(struct vector3));
+    for (size_t i = 0; i < count; i++) {
+        memcpy(points + i * 4, atari_data_list[quads[i]].verts, 4 * sizeof(struct vector3));
+    }
+    
+    struct hull hull = {part};
+    bool built = build_hull(points, count * 4, &hull);
+    free(points);
+    
+    if (!built) {
+        printf("Part %u: %lu quads are flat, no hull\n", part, count);
+        return;
+    }
+    
+    hull.error = hull_volume_error(&hull);
+    
+    if (hull.error > hull_error_max && depth < HULL_DEPTH_MAX && count >= 2) {
+        free(hull.verts);
+        free(hull.faces);
+        
+        struct vector3 min = atari_data_list[quads[0]].verts[0], max = min;
+        for (size_t i = 0; i < count; i++) {
+            for (int v = 0; v < 4; v++) {
+                struct vector3 p = atari_data_list[quads[i]].verts[v];
+                min.x = fminf(min.x, p.x); max.x = fmaxf(max.x, p.x);
+                min.y = fminf(min.y, p.y); max.y = fmaxf(max.y, p.y);
+                min.z = fminf(min.z, p.z); max.z = fmaxf(max.z, p.z);
+            }
+        }
+        struct vector3 size = vec3_sub(max, min);
+        split_axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+        
+        qsort(quads, count, sizeof(size_t), compare_split);
+        add_hulls(part, quads, count / 2, depth + 1);
+        add_hulls(part, quads + count / 2, count - count / 2, depth + 1);
+        return;
+    }
+    
+    hulls = realloc(hulls, (hull_count + 1) * sizeof(struct hull));
+    hulls[hull_count++] = hull;
+}
+
+void build_part_hulls(uint32_t part) {
+    if (!atari_data_count) return;
+    
+    size_t first = hull_count;
+    size_t * quads = malloc(atari_data_count * sizeof(size_t));
+    for (size_t i = 0; i < atari_data_count; i++) quads[i] = i;
+    
+    add_hulls(part, quads, atari_data_count, 0);
+    free(quads);
+    
+    for (size_t h = first; h < hull_count; h++) {
+        printf("Part %u hull %lu: %u vertices, %u faces, volume error %.3f\n", part, h - first,
+            hulls[h].vert_count, hulls[h].face_count, hulls[h].error);
+    }
+}
+
+cgltf_data * load_gltf(const char * path) {
+    for (size_t i = 0; i < gltf_cache_count; i++) {
+        if (!strcmp(gltf_cache[i].path, path)) return gltf_cache[i].data;
     }
     
     cgltf_options options = {0};
     cgltf_data * data = NULL;
-    cgltf_result result = cgltf_parse_file(&options, gltf_path, &data);
+    cgltf_result result = cgltf_parse_file(&options, path, &data);
     if (result != cgltf_result_success) {
-        fclose(ppd);
-        fprintf(stderr, "Failed to open glTF file: %s\n", gltf_path);
-        return 1;
+        fprintf(stderr, "Failed to open glTF file: %s\n", path);
+        return NULL;
     }
+    
+    gltf_cache = realloc(gltf_cache, (gltf_cache_count + 1) * sizeof(struct gltf_entry));
+    gltf_cache[gltf_cache_count].path = strdup(path);
+    gltf_cache[gltf_cache_count].data = data;
+    gltf_cache_count++;
+    
+    return data;
+}
+
+// Converts the PPD at ppd_base, the glTF is only needed for the bone names
+int convert_hitbox(FILE * ppd, const char * out_path, const char * gltf_path) {
+    fseek(ppd, ppd_base, SEEK_SET);
 
     uint32_t margin;
     fread(&margin, sizeof(uint32_t), 1, ppd);
     float margin_scaled = (float)(margin) / scale_factor;
-    printf("Margin: %d, %f\n", margin, margin_scaled);
+    if (verbose) printf("Margin: %d, %f\n", margin, margin_scaled);
     
     uint32_t part_count;
     fread(&part_count, sizeof(uint32_t), 1, ppd);
 
-    printf("Processing %d hitbox parts\n", part_count);
+    if (verbose) printf("Processing %d hitbox parts\n", part_count);
 
     uint32_t zero;
     fread(&zero, sizeof(uint32_t), 1, ppd);
@@ -184,15 +587,6 @@ int main(int argc, char ** argv) {
     uint32_t bone_offset;
     fread(&bone_offset, sizeof(uint32_t), 1, ppd);
     
-    strncpy(out_path, ppd_path, sizeof(out_path));
-
-    char * ext = strrchr(out_path, '.');
-    if (!ext) {
-        fprintf(stderr, "File path is missing extension: %s\n", ppd_path);
-        return 1;
-    }
-    strcpy(ext + 1, "hbx");
-    
     FILE * outf = fopen(out_path, "wb");
     if (!outf) {
         fprintf(stderr, "Failed to open output file: %s\n", out_path);
@@ -201,16 +595,21 @@ int main(int argc, char ** argv) {
     
     fwrite(&part_count, sizeof(uint32_t), 1, outf);
     
+    size_t bvh_part_start[part_count + 1];
+    bvh_node_count = 0;
+    
     for (int p = 0; p < part_count; p++) {
-        fseek(ppd, HEADER_SIZE + part_offsets[p], SEEK_SET);
+        fseek(ppd, ppd_base + HEADER_SIZE + part_offsets[p], SEEK_SET);
         
-        printf("*** Processing part %d ***\n", p);
+        if (verbose) printf("*** Processing part %d ***\n", p);
         
         atari_data_count = 0;
+        bvh_part_start[p] = bvh_node_count;
         if (process_header(ppd, 0)) return 1;
         
-        printf("*** Processed %lu data entries ***\n", atari_data_count);
+        if (verbose) printf("*** Processed %lu data entries ***\n", atari_data_count);
         
+        if (hull_error_max >= 0.0f) build_part_hulls(p);
         fwrite(&atari_data_count, sizeof(uint32_t), 1, outf);
         
         // Output all triangles
@@ -234,13 +633,13 @@ int main(int argc, char ** argv) {
     }
     
     if (bone_offset) {
-        fseek(ppd, HEADER_SIZE + bone_offset, SEEK_SET);
+        fseek(ppd, ppd_base + HEADER_SIZE + bone_offset, SEEK_SET);
         
         uint8_t bone_count, bone_parts;
         fread(&bone_count, sizeof(uint8_t), 1, ppd); // Expected number of bones in the XBO/GLTF
         fread(&bone_parts, sizeof(uint8_t), 1, ppd); // Should be identical to part_count
         
-        printf("Reading data for %d bones, %d parts\n", bone_count, bone_parts);
+        if (verbose) printf("Reading data for %d bones, %d parts\n", bone_count, bone_parts);
         
         if (bone_parts != part_count) {
             printf("Wrong number of parts in bone data: %d != %d\n", bone_parts, part_count);
@@ -248,6 +647,9 @@ int main(int argc, char ** argv) {
         
         fwrite(&bone_parts, sizeof(uint8_t), 1, outf);
 
+        cgltf_data * data = load_gltf(gltf_path);
+        if (!data) return 1;
+
         if (!data->skins_count) {
             fprintf(stderr, "GLTF does not contain any skins");
             return 1;        
@@ -265,7 +667,7 @@ int main(int argc, char ** argv) {
             fread(&bone_id, sizeof(uint8_t), 1, ppd);
             fread(&part_id, sizeof(uint8_t), 1, ppd);
 
-            printf("Index %d, Bone ID %d, Part ID %d\n", i, bone_id, part_id);
+            if (verbose) printf("Index %d, Bone ID %d, Part ID %d\n", i, bone_id, part_id);
             
             if (part_id == 99) continue;
 
@@ -296,15 +698,212 @@ int main(int argc, char ** argv) {
             return 1;
         }
     } else {
-        printf("No bone definitions\n");
+        if (verbose) printf("No bone definitions\n");
         uint8_t no_bones = 0;
         fwrite(&no_bones, sizeof(uint8_t), 1, outf);
     }
     
-    cgltf_free(data);
-    fclose(ppd);
+    // The BVH section goes last so readers of the original layout are unaffected
+    bvh_part_start[part_count] = bvh_node_count;
+    fwrite("BVH0", sizeof(char), 4, outf);
+    
+    for (int p = 0; p < part_count; p++) {
+        struct bvh_node * nodes = bvh_nodes + bvh_part_start[p];
+        uint32_t node_count = bvh_part_start[p + 1] - bvh_part_start[p];
+        
+        fwrite(&node_count, sizeof(uint32_t), 1, outf);
+        
+        // Bounds are stored as six separate arrays so a reader can test several nodes at once
+        for (int i = 0; i < 3; i++) {
+            for (int ni = 0; ni < node_count; ni++) fwrite(nodes[ni].min + i, sizeof(float), 1, outf);
+        }
+        for (int i = 0; i < 3; i++) {
+            for (int ni = 0; ni < node_count; ni++) fwrite(nodes[ni].max + i, sizeof(float), 1, outf);
+        }
+        
+        // Skip indices are stored relative to the part
+        for (int ni = 0; ni < node_count; ni++) {
+            uint32_t skip = nodes[ni].skip - bvh_part_start[p];
+            fwrite(&skip, sizeof(uint32_t), 1, outf);
+        }
+        for (int ni = 0; ni < node_count; ni++) fwrite(&nodes[ni].first, sizeof(uint32_t), 1, outf);
+        for (int ni = 0; ni < node_count; ni++) fwrite(&nodes[ni].count, sizeof(uint32_t), 1, outf);
+        
+        if (verbose) printf("Part %d: %u BVH nodes\n", p, node_count);
+    }
+    
+    if (hull_error_max >= 0.0f) {
+        fwrite("HUL0", sizeof(char), 4, outf);
+        
+        size_t h = 0;
+        for (uint32_t p = 0; p < part_count; p++) {
+            uint32_t part_hulls = 0;
+            while (h + part_hulls < hull_count && hulls[h + part_hulls].part == p) part_hulls++;
+            fwrite(&part_hulls, sizeof(uint32_t), 1, outf);
+            
+            for (; part_hulls; part_hulls--, h++) {
+                fwrite(&hulls[h].error, sizeof(float), 1, outf);
+                fwrite(&hulls[h].vert_count, sizeof(uint32_t), 1, outf);
+                fwrite(hulls[h].verts, sizeof(struct vector3), hulls[h].vert_count, outf);
+                
+                // Triangles followed by their planes
+                fwrite(&hulls[h].face_count, sizeof(uint32_t), 1, outf);
+                for (uint32_t fi = 0; fi < hulls[h].face_count; fi++) {
+                    uint16_t tri[3] = {hulls[h].faces[fi].v[0], hulls[h].faces[fi].v[1], hulls[h].faces[fi].v[2]};
+                    fwrite(tri, sizeof(uint16_t), 3, outf);
+                }
+                for (uint32_t fi = 0; fi < hulls[h].face_count; fi++) {
+                    fwrite(hulls[h].faces[fi].plane, sizeof(float), 4, outf);
+                }
+                
+                free(hulls[h].verts);
+                free(hulls[h].faces);
+            }
+        }
+        
+        hull_count = 0;
+    }
+    
     fclose(outf);
 
     return 0;
 }
 
+/*
+ * Converts every hitbox listed in the mapping file straight out of ATARI.bin. Each line of the
+ * mapping holds a hitbox index and the id of the glTF model its bones belong to.
+ */
+int batch(char * bin_path, char * map_path, char * model_dir, char * out_dir) {
+    FILE * binf = fopen(bin_path, "rb");
+    if (!binf) {
+        fprintf(stderr, "Failed to open binary file: %s\n", bin_path);
+        return 1;
+    }
+    
+    char magic[4];
+    fread(magic, 1, 4, binf);
+    if (strncmp(magic, "BIN0", 4)) {
+        fprintf(stderr, "Invalid magic number in binary file: %s\n", bin_path);
+        return 1;
+    }
+    
+    uint32_t file_count;
+    fread(&file_count, sizeof(uint32_t), 1, binf);
+    
+    struct {
+        uint32_t offset;
+        uint32_t length;
+    } * file_list = malloc(file_count * sizeof(*file_list));
+    fread(file_list, sizeof(*file_list), file_count, binf);
+    
+    FILE * mapf = fopen(map_path, "r");
+    if (!mapf) {
+        fprintf(stderr, "Failed to open mapping file: %s\n", map_path);
+        return 1;
+    }
+    
+    char model_path[256];
+    unsigned int hbx_id, gltf_id, converted = 0;
+    while (fscanf(mapf, "%u %u", &hbx_id, &gltf_id) == 2) {
+        if (hbx_id >= file_count) {
+            fprintf(stderr, "Hitbox %u is not in %s, which has %u files\n", hbx_id, bin_path, file_count);
+            return 1;
+        }
+        
+        snprintf(out_path, sizeof(out_path), "%s/%04u.hbx", out_dir, hbx_id);
+        snprintf(model_path, sizeof(model_path), "%s/%04u.gltf", model_dir, gltf_id);
+        
+        printf("Converting hitbox %u with model %u\n", hbx_id, gltf_id);
+        
+        ppd_base = file_list[hbx_id].offset;
+        if (convert_hitbox(binf, out_path, model_path)) {
+            fprintf(stderr, "Failed to convert hitbox %u\n", hbx_id);
+            return 1;
+        }
+        converted++;
+    }
+    
+    printf("Converted %u hitboxes, %lu glTF files parsed\n", converted, gltf_cache_count);
+    
+    free(file_list);
+    fclose(mapf);
+    fclose(binf);
+    
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    progname = *argv++; argc--;
+
+    printf("SB Hitbox Tool - By QuantX\n");
+
+    bool batch_mode = argc >= 5 && !strcmp(*argv, "--batch");
+    int positional = batch_mode ? 5 : 2;
+    
+    if (argc < positional) {
+        fprintf(stderr, "Please specify a PPD file: %s <path/example.ppd> <path/example.gltf> (--hulls <max error>)\n",
+            progname);
+        fprintf(stderr, "Or a whole binary: %s --batch <ATARI.bin> <mapping.txt> <model folder> <output folder> "
+            "(--verbose) (--hulls <max error>)\n", progname);
+        return 1;
+    }
+    
+    verbose = !batch_mode;
+    for (int i = positional; i < argc; i++) {
+        if (!strcmp(argv[i], "--verbose")) {
+            verbose = true;
+        } else if (!strcmp(argv[i], "--hulls") && i + 1 < argc) {
+            char * end;
+            hull_error_max = strtof(argv[++i], &end);
+            if (end == argv[i] || *end || !(hull_error_max >= 0.0f) || isinf(hull_error_max)) {
+                fprintf(stderr, "Invalid hull volume error '%s', expected a non-negative number\n", argv[i]);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    
+    int ret;
+    if (batch_mode) {
+        ret = batch(argv[1], argv[2], argv[3], argv[4]);
+    } else {
+        ppd_path = *argv++; argc--;
+        gltf_path = *argv++; argc--;
+        
+        FILE * ppd = fopen(ppd_path, "rb");
+        if (!ppd) {
+            fprintf(stderr, "Failed to open PPD file: %s\n", ppd_path);
+            return 1;
+        }
+        
+        if (!load_gltf(gltf_path)) {
+            fclose(ppd);
+            return 1;
+        }
+        
+        strncpy(out_path, ppd_path, sizeof(out_path));
+
+        char * ext = strrchr(out_path, '.');
+        if (!ext) {
+            fprintf(stderr, "File path is missing extension: %s\n", ppd_path);
+            return 1;
+        }
+        strcpy(ext + 1, "hbx");
+        
+        ret = convert_hitbox(ppd, out_path, gltf_path);
+        fclose(ppd);
+    }
+    
+    for (size_t i = 0; i < gltf_cache_count; i++) {
+        cgltf_free(gltf_cache[i].data);
+        free(gltf_cache[i].path);
+    }
+    free(gltf_cache);
+    free(atari_data_list);
+    free(bvh_nodes);
+    free(hulls);
+
+    return ret;
+}
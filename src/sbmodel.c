@@ -5,6 +5,10 @@
 #include <stdbool.h>
 #include <math.h>
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 #define CGLTF_IMPLEMENTATION
 #define CGLTF_WRITE_IMPLEMENTATION
 #define CGLTF_VALIDATE_ENABLE_ASSERTS 1
@@ -27,10 +31,28 @@
 
 char path[256];
 
-const unsigned int verts_stride = 8 * sizeof(float) + 12 * sizeof(uint8_t);
 const float scale_factor = 0.01f;
 
 bool flip_faces = false;
+bool merge_meshes = false;
+bool build_meshlets = false;
+bool weld_vertices = false;
+
+#define MESHLET_VERTS_MAX 64
+#define MESHLET_TRIS_MAX 124
+
+#define LOD_COUNT_MAX 3
+
+struct lod_level {
+    float ratio; // Fraction of the source triangles to keep
+    float error; // Maximum error relative to the size of each mesh
+};
+
+struct lod_level lod_levels[LOD_COUNT_MAX];
+int lod_count = 0;
+
+const float lod_error_default = 0.01f;
+const float lod_screen_height = 1080.0f; // Used to turn LOD error into screen coverage hints
 
 const cgltf_primitive_type prim_type = cgltf_primitive_type_triangle_strip;
 
@@ -47,6 +69,17 @@ struct vector3 {
     float x, y, z;
 };
 
+struct vertex {
+    float pos[3];
+    float norm[3];
+    float uv[2];
+    uint8_t joints[4];
+    uint8_t weights[4];
+    uint8_t color[4];
+};
+
+const unsigned int verts_stride = sizeof(struct vertex);
+
 struct primative {
     uint32_t offset;
     uint32_t size;
@@ -57,6 +90,44 @@ struct primative {
     struct vector3 pos, dir;
 };
 
+struct collapse {
+    float cost;
+    uint16_t from, to;
+};
+
+struct position_ref {
+    float pos[3];
+    uint16_t index;
+};
+
+struct sphere {
+    float center[3];
+    float radius;
+};
+
+struct meshlet {
+    uint32_t vertex_offset;   // First entry in the meshlet vertex list
+    uint32_t triangle_offset; // Byte offset in the meshlet triangle list
+    uint32_t vertex_count;
+    uint32_t triangle_count;
+    struct sphere bounds;
+    float cone_apex[3];
+    float cone_axis[3];
+    float cone_cutoff; // Backface cull when dot(normalize(cone_apex - camera), cone_axis) >= cone_cutoff
+    uint32_t joint;    // Every meshlet is bound to a single joint, the bounds are in its space
+};
+
+struct meshlet_list {
+    struct meshlet * meshlets;
+    uint32_t meshlet_count;
+    
+    uint16_t * vertices;
+    uint32_t vertex_count;
+    
+    uint8_t * triangles;
+    uint32_t triangle_size; // In bytes, each meshlet is padded to 4 bytes
+};
+
 char * progname;
 
 void euler2quat(float quat[4], struct vector3 euler) {
@@ -74,21 +145,595 @@ void euler2quat(float quat[4], struct vector3 euler) {
     quat[3] = cx * cy * cz + sx * sy * sz; // W
 }
 
+uint32_t strip_to_triangles(const uint16_t * strip, uint32_t count, uint16_t * tris) {
+    uint32_t out = 0;
+    for (uint32_t i = 2; i < count; i++) {
+        uint16_t a = strip[i - 2], b = strip[i - 1], c = strip[i];
+        if (a == b || b == c || c == a) continue; // Skip degenerate restart triangles
+        
+        // Every other triangle in a strip has reversed winding
+        if (i % 2) {
+            tris[out++] = b;
+            tris[out++] = a;
+        } else {
+            tris[out++] = a;
+            tris[out++] = b;
+        }
+        tris[out++] = c;
+    }
+    return out;
+}
+
+// Plane quadrics are stored as the upper triangle of the symmetric 4x4 matrix followed by the area weight
+static void quadric_add_plane(double q[11], const float p0[3], const float p1[3], const float p2[3]) {
+    double e0[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double e1[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    
+    double n[3] = {
+        e0[1] * e1[2] - e0[2] * e1[1],
+        e0[2] * e1[0] - e0[0] * e1[2],
+        e0[0] * e1[1] - e0[1] * e1[0],
+    };
+    
+    double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len <= 0.0) return; // Zero area triangles have no plane
+    
+    double a = n[0] / len, b = n[1] / len, c = n[2] / len;
+    double d = -(a * p0[0] + b * p0[1] + c * p0[2]);
+    double w = len * 0.5; // Weight by triangle area
+    
+    q[0] += w * a * a; q[1] += w * a * b; q[2] += w * a * c; q[3] += w * a * d;
+                       q[4] += w * b * b; q[5] += w * b * c; q[6] += w * b * d;
+                                          q[7] += w * c * c; q[8] += w * c * d;
+                                                             q[9] += w * d * d;
+    q[10] += w;
+}
+
+// Area weighted mean of the squared distances to all planes in the quadric
+static double quadric_error(const double q[11], const float p[3]) {
+    double x = p[0], y = p[1], z = p[2];
+    
+    double err = q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+                              +     q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+                                                 +     q[7] * z * z + 2 * q[8] * z
+                                                                    +     q[9];
+    return err > 0.0 && q[10] > 0.0 ? err / q[10] : 0.0;
+}
+
+static void triangle_normal(const float p0[3], const float p1[3], const float p2[3], double n[3]) {
+    double e0[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+    double e1[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+    
+    n[0] = e0[1] * e1[2] - e0[2] * e1[1];
+    n[1] = e0[2] * e1[0] - e0[0] * e1[2];
+    n[2] = e0[0] * e1[1] - e0[1] * e1[0];
+}
+
+int compare_uint32(const void * a, const void * b) {
+    uint32_t ua = *(const uint32_t *)a, ub = *(const uint32_t *)b;
+    return (ua > ub) - (ua < ub);
+}
+
+int compare_collapse(const void * a, const void * b) {
+    float ca = ((const struct collapse *)a)->cost;
+    float cb = ((const struct collapse *)b)->cost;
+    return (ca > cb) - (ca < cb);
+}
+
+int compare_position(const void * a, const void * b) {
+    const struct position_ref * pa = a, * pb = b;
+    int r = memcmp(pa->pos, pb->pos, sizeof(float) * 3);
+    return r ? r : (pa->index > pb->index) - (pa->index < pb->index);
+}
+
+/*
+ * Quadric error metric simplification of an indexed triangle list using half edge collapses.
+ * Vertices only ever collapse onto existing vertices of the same mesh, so the rigid joint
+ * binding and the other vertex attributes stay intact. Vertices on open borders or on UV/normal
+ * seams (several vertices sharing a position) are locked to prevent cracks.
+ * The triangle list is rewritten in place, returns the new index count.
+ */
+uint32_t simplify_triangles(const struct vertex * verts, uint32_t vert_count, uint16_t * tris, uint32_t ind_count,
+                            uint32_t target_count, float max_error, float * out_error)
+{
+    *out_error = 0.0f;
+    if (ind_count <= target_count) return ind_count;
+    
+    // Group vertices by position to find seams
+    struct position_ref * order = malloc(vert_count * sizeof(struct position_ref));
+    for (uint32_t vi = 0; vi < vert_count; vi++) {
+        memcpy(order[vi].pos, verts[vi].pos, sizeof(float) * 3);
+        order[vi].index = vi;
+    }
+    qsort(order, vert_count, sizeof(struct position_ref), compare_position);
+    
+    uint16_t * pos_class = malloc(vert_count * sizeof(uint16_t));
+    bool * locked = calloc(vert_count, sizeof(bool));
+    for (uint32_t oi = 0; oi < vert_count; oi++) {
+        uint16_t vi = order[oi].index;
+        if (oi && !memcmp(order[oi].pos, order[oi - 1].pos, sizeof(float) * 3)) {
+            pos_class[vi] = pos_class[order[oi - 1].index];
+            locked[vi] = locked[order[oi - 1].index] = true;
+        } else {
+            pos_class[vi] = vi;
+        }
+    }
+    
+    // Lock border vertices, an edge used by a single triangle is a border
+    uint32_t edge_count = ind_count;
+    uint32_t * edges = malloc(edge_count * sizeof(uint32_t));
+    for (uint32_t ti = 0; ti < ind_count; ti += 3) {
+        for (int e = 0; e < 3; e++) {
+            uint32_t a = pos_class[tris[ti + e]], b = pos_class[tris[ti + (e + 1) % 3]];
+            edges[ti + e] = a < b ? (a << 16) | b : (b << 16) | a;
+        }
+    }
+    qsort(edges, edge_count, sizeof(uint32_t), compare_uint32);
+    
+    bool * border = calloc(vert_count, sizeof(bool));
+    for (uint32_t ei = 0; ei < edge_count; ) {
+        uint32_t ej = ei + 1;
+        while (ej < edge_count && edges[ej] == edges[ei]) ej++;
+        if (ej - ei == 1) {
+            border[edges[ei] >> 16] = true;
+            border[edges[ei] & 0xFFFF] = true;
+        }
+        ei = ej;
+    }
+    for (uint32_t vi = 0; vi < vert_count; vi++) {
+        if (border[pos_class[vi]]) locked[vi] = true;
+    }
+    free(border);
+    free(edges);
+    free(order);
+    
+    double (* quadrics)[11] = calloc(vert_count, sizeof(double[11]));
+    for (uint32_t ti = 0; ti < ind_count; ti += 3) {
+        double q[11] = {0};
+        quadric_add_plane(q, verts[tris[ti]].pos, verts[tris[ti + 1]].pos, verts[tris[ti + 2]].pos);
+        for (int c = 0; c < 3; c++) {
+            for (int k = 0; k < 11; k++) quadrics[tris[ti + c]][k] += q[k];
+        }
+    }
+    
+    uint32_t * adj_offsets = malloc((vert_count + 1) * sizeof(uint32_t));
+    uint32_t * adj_tris = malloc(ind_count * sizeof(uint32_t));
+    struct collapse * collapses = malloc(ind_count * 2 * sizeof(struct collapse));
+    uint16_t * remap = malloc(vert_count * sizeof(uint16_t));
+    bool * dirty = malloc(vert_count * sizeof(bool));
+    
+    double error_limit = (double)max_error * max_error;
+    double error_max = 0.0;
+    bool error_reached = false;
+    
+    while (ind_count > target_count && !error_reached) {
+        // Build vertex to triangle adjacency
+        memset(adj_offsets, 0, (vert_count + 1) * sizeof(uint32_t));
+        for (uint32_t i = 0; i < ind_count; i++) adj_offsets[tris[i] + 1]++;
+        for (uint32_t vi = 0; vi < vert_count; vi++) adj_offsets[vi + 1] += adj_offsets[vi];
+        for (uint32_t i = 0; i < ind_count; i++) adj_tris[adj_offsets[tris[i]]++] = i / 3;
+        for (uint32_t vi = vert_count; vi > 0; vi--) adj_offsets[vi] = adj_offsets[vi - 1];
+        adj_offsets[0] = 0;
+        
+        // Gather all possible half edge collapses
+        uint32_t collapse_count = 0;
+        for (uint32_t ti = 0; ti < ind_count; ti += 3) {
+            for (int e = 0; e < 3; e++) {
+                uint16_t a = tris[ti + e], b = tris[ti + (e + 1) % 3];
+                
+                for (int dir = 0; dir < 2; dir++) {
+                    uint16_t from = dir ? b : a, to = dir ? a : b;
+                    if (locked[from]) continue;
+                    
+                    double q[11];
+                    for (int k = 0; k < 11; k++) q[k] = quadrics[from][k] + quadrics[to][k];
+                    
+                    struct collapse * col = collapses + collapse_count++;
+                    col->cost = quadric_error(q, verts[to].pos);
+                    col->from = from;
+                    col->to = to;
+                }
+            }
+        }
+        
+        if (!collapse_count) break;
+        qsort(collapses, collapse_count, sizeof(struct collapse), compare_collapse);
+        
+        for (uint32_t vi = 0; vi < vert_count; vi++) remap[vi] = vi;
+        memset(dirty, 0, vert_count * sizeof(bool));
+        
+        uint32_t tri_count = ind_count / 3;
+        uint32_t target_tris = target_count / 3;
+        uint32_t collapsed = 0;
+        
+        for (uint32_t ci = 0; ci < collapse_count && tri_count > target_tris; ci++) {
+            struct collapse * col = collapses + ci;
+            
+            if (col->cost > error_limit) {
+                error_reached = true;
+                break;
+            }
+            
+            if (dirty[col->from] || dirty[col->to]) continue;
+            
+            // Reject collapses that would flip a triangle
+            uint32_t removed = 0;
+            bool flipped = false;
+            for (uint32_t ai = adj_offsets[col->from]; ai < adj_offsets[col->from + 1]; ai++) {
+                uint16_t * tri = tris + adj_tris[ai] * 3;
+                if (tri[0] == col->to || tri[1] == col->to || tri[2] == col->to) {
+                    removed++;
+                    continue;
+                }
+                
+                const float * p[3], * pn[3];
+                for (int c = 0; c < 3; c++) {
+                    p[c] = verts[tri[c]].pos;
+                    pn[c] = tri[c] == col->from ? verts[col->to].pos : p[c];
+                }
+                
+                double n0[3], n1[3];
+                triangle_normal(p[0], p[1], p[2], n0);
+                triangle_normal(pn[0], pn[1], pn[2], n1);
+                
+                if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0) {
+                    flipped = true;
+                    break;
+                }
+            }
+            
+            if (flipped) continue;
+            
+            remap[col->from] = col->to;
+            for (int k = 0; k < 11; k++) quadrics[col->to][k] += quadrics[col->from][k];
+            
+            // Don't touch anything around this collapse again until the next pass
+            for (uint32_t ai = adj_offsets[col->from]; ai < adj_offsets[col->from + 1]; ai++) {
+                uint16_t * tri = tris + adj_tris[ai] * 3;
+                dirty[tri[0]] = dirty[tri[1]] = dirty[tri[2]] = true;
+            }
+            
+            error_max = fmax(error_max, col->cost);
+            tri_count -= removed;
+            collapsed++;
+        }
+        
+        if (!collapsed) break;
+        
+        // Apply collapses and drop the degenerate triangles
+        uint32_t out = 0;
+        for (uint32_t ti = 0; ti < ind_count; ti += 3) {
+            uint16_t a = remap[tris[ti]], b = remap[tris[ti + 1]], c = remap[tris[ti + 2]];
+            if (a == b || b == c || c == a) continue;
+            
+            tris[out++] = a;
+            tris[out++] = b;
+            tris[out++] = c;
+        }
+        ind_count = out;
+    }
+    
+    *out_error = sqrt(error_max);
+    
+    free(adj_offsets);
+    free(adj_tris);
+    free(collapses);
+    free(remap);
+    free(dirty);
+    free(quadrics);
+    free(locked);
+    free(pos_class);
+    
+    return ind_count;
+}
+
+// Ritter's bounding sphere
+struct sphere bounding_sphere(const struct vertex * verts, const uint16_t * inds, uint32_t count) {
+    struct sphere s = {{0.0f, 0.0f, 0.0f}, 0.0f};
+    if (!count) return s;
+    
+    const float * p0 = verts[inds[0]].pos;
+    const float * px = p0, * py = p0;
+    float dmax = 0.0f;
+    for (uint32_t i = 0; i < count; i++) {
+        const float * p = verts[inds[i]].pos;
+        float d = (p[0] - p0[0]) * (p[0] - p0[0]) + (p[1] - p0[1]) * (p[1] - p0[1]) + (p[2] - p0[2]) * (p[2] - p0[2]);
+        if (d > dmax) { dmax = d; px = p; }
+    }
+    dmax = 0.0f;
+    for (uint32_t i = 0; i < count; i++) {
+        const float * p = verts[inds[i]].pos;
+        float d = (p[0] - px[0]) * (p[0] - px[0]) + (p[1] - px[1]) * (p[1] - px[1]) + (p[2] - px[2]) * (p[2] - px[2]);
+        if (d > dmax) { dmax = d; py = p; }
+    }
+    
+    for (int c = 0; c < 3; c++) s.center[c] = (px[c] + py[c]) * 0.5f;
+    s.radius = sqrtf(dmax) * 0.5f;
+    
+    // Grow the sphere to enclose any remaining points
+    for (uint32_t i = 0; i < count; i++) {
+        const float * p = verts[inds[i]].pos;
+        float d[3] = {p[0] - s.center[0], p[1] - s.center[1], p[2] - s.center[2]};
+        float dist = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        if (dist <= s.radius) continue;
+        
+        float grow = (dist - s.radius) * 0.5f;
+        for (int c = 0; c < 3; c++) s.center[c] += d[c] / dist * grow;
+        s.radius += grow;
+    }
+    
+    return s;
+}
+
+void meshlet_bounds(const struct vertex * verts, struct meshlet_list * list, struct meshlet * m) {
+    const uint16_t * mverts = list->vertices + m->vertex_offset;
+    const uint8_t * mtris = list->triangles + m->triangle_offset;
+    
+    m->bounds = bounding_sphere(verts, mverts, m->vertex_count);
+    
+    float normals[MESHLET_TRIS_MAX][3];
+    float axis[3] = {0.0f, 0.0f, 0.0f};
+    for (uint32_t ti = 0; ti < m->triangle_count; ti++) {
+        double n[3];
+        triangle_normal(verts[mverts[mtris[ti * 3]]].pos, verts[mverts[mtris[ti * 3 + 1]]].pos,
+                        verts[mverts[mtris[ti * 3 + 2]]].pos, n);
+        
+        double len = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int c = 0; c < 3; c++) {
+            normals[ti][c] = len > 0.0 ? n[c] / len : 0.0f;
+            axis[c] += normals[ti][c];
+        }
+    }
+    
+    memcpy(m->cone_apex, m->bounds.center, sizeof(m->cone_apex));
+    memset(m->cone_axis, 0, sizeof(m->cone_axis));
+    m->cone_cutoff = 1.0f; // Never cull
+    
+    float axis_len = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+    if (axis_len <= 0.0f) return;
+    for (int c = 0; c < 3; c++) axis[c] /= axis_len;
+    
+    float mindp = 1.0f;
+    for (uint32_t ti = 0; ti < m->triangle_count; ti++) {
+        float dp = normals[ti][0] * axis[0] + normals[ti][1] * axis[1] + normals[ti][2] * axis[2];
+        mindp = fminf(mindp, dp);
+    }
+    
+    // The normals are spread too wide for the cone to ever cull anything
+    if (mindp <= 0.1f) return;
+    
+    // Move the apex back so every triangle plane is in front of it
+    float maxt = 0.0f;
+    for (uint32_t ti = 0; ti < m->triangle_count; ti++) {
+        const float * p0 = verts[mverts[mtris[ti * 3]]].pos;
+        const float * n = normals[ti];
+        
+        float dc = (m->bounds.center[0] - p0[0]) * n[0] + (m->bounds.center[1] - p0[1]) * n[1] + (m->bounds.center[2] - p0[2]) * n[2];
+        float dn = axis[0] * n[0] + axis[1] * n[1] + axis[2] * n[2];
+        maxt = fmaxf(maxt, dc / dn);
+    }
+    
+    for (int c = 0; c < 3; c++) m->cone_apex[c] = m->bounds.center[c] - axis[c] * maxt;
+    memcpy(m->cone_axis, axis, sizeof(m->cone_axis));
+    m->cone_cutoff = sqrtf(1.0f - mindp * mindp);
+}
+
+/*
+ * Greedily split a triangle list into meshlets of at most MESHLET_VERTS_MAX vertices and
+ * MESHLET_TRIS_MAX triangles, triangles are taken in order so strip locality is kept.
+ * A meshlet never spans multiple joints so its bounds stay valid under skinning.
+ */
+uint32_t meshlets_build(const struct vertex * verts, uint32_t vert_count, const uint16_t * tris, uint32_t ind_count,
+                        struct meshlet_list * list)
+{
+    uint8_t * local = malloc(vert_count);
+    memset(local, 0xFF, vert_count);
+    
+    // Reserve enough room for the worst case of one meshlet per triangle
+    uint32_t tri_count = ind_count / 3;
+    list->meshlets = realloc(list->meshlets, (list->meshlet_count + tri_count) * sizeof(struct meshlet));
+    list->vertices = realloc(list->vertices, (list->vertex_count + ind_count) * sizeof(uint16_t));
+    list->triangles = realloc(list->triangles, list->triangle_size + tri_count * 4);
+    
+    uint32_t first = list->meshlet_count;
+    struct meshlet m = {0};
+    
+    for (uint32_t ti = 0; ti <= ind_count; ti += 3) {
+        const uint16_t * tri = tris + ti;
+        
+        uint32_t new_verts = 0;
+        if (ti < ind_count) {
+            for (int c = 0; c < 3; c++) {
+                if (local[tri[c]] == 0xFF) new_verts++;
+            }
+        }
+        
+        bool full = m.vertex_count + new_verts > MESHLET_VERTS_MAX || m.triangle_count + 1 > MESHLET_TRIS_MAX;
+        bool joint_change = m.triangle_count && ti < ind_count && verts[tri[0]].joints[0] != m.joint;
+        
+        if (m.triangle_count && (ti >= ind_count || full || joint_change)) {
+            for (uint32_t vi = 0; vi < m.vertex_count; vi++) local[list->vertices[m.vertex_offset + vi]] = 0xFF;
+            
+            // Pad the triangle list to 4 bytes
+            while (list->triangle_size % 4) list->triangles[list->triangle_size++] = 0;
+            
+            meshlet_bounds(verts, list, &m);
+            list->meshlets[list->meshlet_count++] = m;
+            
+            memset(&m, 0, sizeof(m));
+        }
+        
+        if (ti >= ind_count) break;
+        
+        if (!m.triangle_count) {
+            m.vertex_offset = list->vertex_count;
+            m.triangle_offset = list->triangle_size;
+            m.joint = verts[tri[0]].joints[0];
+        }
+        
+        for (int c = 0; c < 3; c++) {
+            if (local[tri[c]] == 0xFF) {
+                local[tri[c]] = m.vertex_count++;
+                list->vertices[list->vertex_count++] = tri[c];
+            }
+            list->triangles[list->triangle_size++] = local[tri[c]];
+        }
+        m.triangle_count++;
+    }
+    
+    free(local);
+    return list->meshlet_count - first;
+}
+
+// Normalises the vertex normals four at a time, the normals are gathered into SoA arrays first
+void normalize_normals(struct vertex * verts, uint32_t count) {
+    float * nx = malloc((count + 3) * 3 * sizeof(float));
+    float * ny = nx + count + 3;
+    float * nz = ny + count + 3;
+    
+    for (uint32_t vi = 0; vi < count; vi++) {
+        nx[vi] = verts[vi].norm[0];
+        ny[vi] = verts[vi].norm[1];
+        nz[vi] = verts[vi].norm[2];
+    }
+    
+    uint32_t vi = 0;
+#ifdef __SSE2__
+    for (; vi + 4 <= count; vi += 4) {
+        __m128 x = _mm_loadu_ps(nx + vi);
+        __m128 y = _mm_loadu_ps(ny + vi);
+        __m128 z = _mm_loadu_ps(nz + vi);
+        
+        __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        
+        _mm_storeu_ps(nx + vi, _mm_div_ps(x, len));
+        _mm_storeu_ps(ny + vi, _mm_div_ps(y, len));
+        _mm_storeu_ps(nz + vi, _mm_div_ps(z, len));
+    }
+#endif
+    for (; vi < count; vi++) {
+        float len = sqrt((nx[vi] * nx[vi]) + (ny[vi] * ny[vi]) + (nz[vi] * nz[vi]));
+        nx[vi] /= len;
+        ny[vi] /= len;
+        nz[vi] /= len;
+    }
+    
+    for (vi = 0; vi < count; vi++) {
+        verts[vi].norm[0] = nx[vi];
+        verts[vi].norm[1] = ny[vi];
+        verts[vi].norm[2] = nz[vi];
+    }
+    
+    free(nx);
+}
+
+// FNV-1a over the whole vertex record
+static uint32_t vertex_hash(const struct vertex * vert) {
+    const uint8_t * bytes = (const uint8_t *)vert;
+    uint32_t hash = 2166136261u;
+    for (int bi = 0; bi < sizeof(struct vertex); bi++) {
+        hash ^= bytes[bi];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Welds bit identical vertices in place and remaps the indices, returns the new vertex count
+uint32_t weld_mesh(struct vertex * verts, uint32_t vert_count, uint16_t * inds, uint32_t ind_count) {
+    uint32_t table_size = 1;
+    while (table_size < vert_count * 2) table_size <<= 1;
+    
+    uint32_t * table = malloc(table_size * sizeof(uint32_t));
+    memset(table, 0xFF, table_size * sizeof(uint32_t));
+    
+    uint16_t * remap = malloc(vert_count * sizeof(uint16_t));
+    uint32_t unique = 0;
+    
+    for (uint32_t vi = 0; vi < vert_count; vi++) {
+        uint32_t slot = vertex_hash(verts + vi) & (table_size - 1);
+        
+        while (table[slot] != UINT32_MAX && memcmp(verts + table[slot], verts + vi, sizeof(struct vertex))) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        
+        if (table[slot] == UINT32_MAX) {
+            // Unique vertices are compacted towards the front, never past the ones still to be hashed
+            if (unique != vi) verts[unique] = verts[vi];
+            table[slot] = unique;
+            remap[vi] = unique++;
+        } else {
+            remap[vi] = table[slot];
+        }
+    }
+    
+    for (uint32_t ii = 0; ii < ind_count; ii++) {
+        if (inds[ii] < vert_count) inds[ii] = remap[inds[ii]];
+    }
+    
+    free(remap);
+    free(table);
+    
+    return unique;
+}
+
+// The primitive bounds are left out when they don't apply to a single joint
+char * meshlet_extras(const struct sphere * bounds, uint32_t first, uint32_t count) {
+    char extras[256];
+    int len = snprintf(extras, sizeof(extras), "{");
+    if (bounds) {
+        len += snprintf(extras + len, sizeof(extras) - len, "\"bounds\": {\"center\": [%f, %f, %f], \"radius\": %f}, ",
+            bounds->center[0], bounds->center[1], bounds->center[2], bounds->radius);
+    }
+    snprintf(extras + len, sizeof(extras) - len,
+        "\"meshlets\": {\"descriptors\": 2, \"vertices\": 3, \"triangles\": 4, \"first\": %u, \"count\": %u}}", first, count);
+    return strdup(extras);
+}
+
 int main(int argc, char ** argv) {
     progname = *argv++; argc--;
 
     printf("SB Model Tool - By QuantX\n");
 
     if (!argc) {
-        fprintf(stderr, "Please specify an XBO model file: %s <path/example.xbo> (--flip)\n", progname);
+        fprintf(stderr, "Please specify an XBO model file: %s <path/example.xbo> (--flip) (--weld) (--merge) (--meshlets) (--lod <ratio>[:<error>] ...)\n", progname);
         return 1;
     }
     
     strncpy(path, *argv, sizeof(path));
     argv++; argc--;
     
-    if (argc && !strcmp(*argv, "--flip")) {
-        flip_faces = true;
+    while (argc) {
+        if (!strcmp(*argv, "--flip")) {
+            flip_faces = true;
+        } else if (!strcmp(*argv, "--merge")) {
+            merge_meshes = true;
+        } else if (!strcmp(*argv, "--meshlets")) {
+            build_meshlets = true;
+        } else if (!strcmp(*argv, "--weld")) {
+            weld_vertices = true;
+        } else if (!strcmp(*argv, "--lod") && argc > 1) {
+            argv++; argc--;
+            
+            if (lod_count >= LOD_COUNT_MAX) {
+                fprintf(stderr, "At most %d LOD levels can be generated\n", LOD_COUNT_MAX);
+                return 1;
+            }
+            
+            struct lod_level * lod = lod_levels + lod_count++;
+            lod->error = lod_error_default;
+            
+            char * end;
+            lod->ratio = strtof(*argv, &end);
+            if (*end == ':') lod->error = strtof(end + 1, &end);
+            
+            if (*end || lod->ratio <= 0.0f || lod->ratio >= 1.0f || lod->error < 0.0f) {
+                fprintf(stderr, "Invalid LOD level '%s', expected <ratio>[:<error>] with a ratio between 0 and 1\n", *argv);
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", *argv);
+            return 1;
+        }
         argv++; argc--;
     }
     
@@ -187,6 +832,9 @@ int main(int argc, char ** argv) {
     
     struct primative * verts_out = malloc(mesh_count * sizeof(struct primative));
     
+    struct vertex * vert_data = NULL;
+    uint32_t vert_total = 0;
+    
     // Mesh data
     for (uint8_t mi = 0; mi < mesh_count; mi++) {
         //fseek(sbmdl, MODEL_HEADER_OFFSET + verts_in[mi].offset, SEEK_SET);
@@ -308,9 +956,13 @@ int main(int argc, char ** argv) {
         verts_out[mi].size = vert_count * verts_stride;
         
         printf("Reading %d vertices for %d triangles\n", vert_count, triangle_count);
+        
+        vert_data = realloc(vert_data, (vert_total + vert_count) * sizeof(struct vertex));
 
         // Vertex data
         for (int vi = 0; vi < vert_count; vi++) {
+            struct vertex * vert = vert_data + vert_total + vi;
+            
             float vp[3];
             if (is_floats) {
                 fread(vp, sizeof(float), 3, sbmdl);
@@ -323,7 +975,7 @@ int main(int argc, char ** argv) {
                 }
             }
 
-            fwrite(vp, sizeof(float), 3, outf);
+            memcpy(vert->pos, vp, sizeof(vert->pos));
 
             if (!vi) {
                 verts_out[mi].max.x = verts_out[mi].min.x = vp[0];
@@ -347,14 +999,8 @@ int main(int argc, char ** argv) {
             // Prevent divide by zero error
             if (!vni[0] && !vni[1] && !vni[2]) vn[0] = 1.0f;
             
-            // Normalize
-            float vn_len = sqrt((vn[0] * vn[0]) + (vn[1] * vn[1]) + (vn[2] * vn[2]));
-            
-            vn[0] /= vn_len;
-            vn[1] /= vn_len;
-            vn[2] /= vn_len;
-            
-            fwrite(vn, sizeof(float), 3, outf);
+            // Normalized once the whole mesh is read
+            memcpy(vert->norm, vn, sizeof(vert->norm));
 
             // Vertex color
             uint8_t color[4] = {0xFF, 0xFF, 0xFF, 0xFF}; // Default to white
@@ -378,16 +1024,20 @@ int main(int argc, char ** argv) {
                 vt[0] /= 32768.0f;
                 vt[1] /= 32768.0f;
             }
-            fwrite(vt, sizeof(float), 2, outf);
+            memcpy(vert->uv, vt, sizeof(vert->uv));
             
             uint8_t joints[4] = {mi + 1};
-            fwrite(joints, sizeof(uint8_t), 4, outf);
+            memcpy(vert->joints, joints, sizeof(vert->joints));
             
             uint8_t weights[4] = {0xFF};
-            fwrite(weights, sizeof(uint8_t), 4, outf);
+            memcpy(vert->weights, weights, sizeof(vert->weights));
 
-            fwrite(color, sizeof(uint8_t), 4, outf);
+            memcpy(vert->color, color, sizeof(vert->color));
         }
+        
+        normalize_normals(vert_data + vert_total, vert_count);
+        
+        vert_total += vert_count;
     }
     
     if (extra) {
@@ -499,6 +1149,9 @@ int main(int argc, char ** argv) {
     
     struct primative * inds_out = malloc(mesh_count * sizeof(struct primative));
     
+    uint16_t * ind_data = NULL;
+    uint32_t ind_total = 0;
+    
     //printf("Index offset last %08X %08X\n", indexes[mesh_count - 1].offset, indexes[mesh_count - 1].size);
     
     for (int mi = 0; mi < mesh_count; mi++) {
@@ -514,6 +1167,9 @@ int main(int argc, char ** argv) {
         
         printf("Mesh %d: Reading %d indexes\n", mi, inds);
         
+        ind_data = realloc(ind_data, (ind_total + inds * 3) * sizeof(uint16_t));
+        uint16_t * ind_out = ind_data + ind_total;
+        
         if (prim_type == cgltf_primitive_type_triangle_strip) {
             inds_out[mi].count = inds;
             for (int ci = 0; ci < inds; ci++) {
@@ -522,11 +1178,11 @@ int main(int argc, char ** argv) {
                 
                 if (flip_faces && !ci) {
                     // Reverse the winding order
-                    fwrite(&ind, sizeof(uint16_t), 1, outf);
+                    *ind_out++ = ind;
                     inds_out[mi].count++;
                 }
                 
-                fwrite(&ind, sizeof(uint16_t), 1, outf);
+                *ind_out++ = ind;
             }
         } else if (prim_type == cgltf_primitive_type_triangles) {
             inds_out[mi].count = 0;
@@ -538,7 +1194,8 @@ int main(int argc, char ** argv) {
                 
                 if (ci >= 2) {
                     if (inds == 3 || (face[0] != face[1] && face[1] != face[2] && face[2] != face[0])) {
-                        fwrite(face, sizeof(uint16_t), 3, outf);
+                        memcpy(ind_out, face, sizeof(face));
+                        ind_out += 3;
                         inds_out[mi].count += 3;
                     }
                 }
@@ -551,11 +1208,223 @@ int main(int argc, char ** argv) {
         }
         
         inds_out[mi].size = inds_out[mi].count * sizeof(uint16_t);
+        ind_total += inds_out[mi].count;
     }
 
-    fclose(outf);
     fclose(sbmdl);
     
+    if (weld_vertices) {
+        uint32_t weld_total = 0;
+        
+        for (int mi = 0; mi < mesh_count; mi++) {
+            struct vertex * verts = vert_data + verts_out[mi].offset / verts_stride;
+            uint16_t * inds = ind_data + inds_out[mi].offset / sizeof(uint16_t);
+            
+            uint32_t welded = weld_mesh(verts, verts_out[mi].count, inds, inds_out[mi].count);
+            
+            // Close the gap left behind so the meshes stay tightly packed
+            uint32_t offset = mi ? verts_out[mi - 1].offset + verts_out[mi - 1].size : 0;
+            memmove(vert_data + offset / verts_stride, verts, welded * sizeof(struct vertex));
+            
+            printf("Mesh %d: Welded %d vertices to %d\n", mi, verts_out[mi].count, welded);
+            
+            verts_out[mi].offset = offset;
+            verts_out[mi].count = welded;
+            verts_out[mi].size = welded * verts_stride;
+            weld_total += welded;
+        }
+        
+        printf("Welding saved %u bytes (%u of %u vertices removed)\n",
+            (vert_total - weld_total) * verts_stride, vert_total - weld_total, vert_total);
+        vert_total = weld_total;
+    }
+    
+    // Generate the simplified index lists for each LOD level
+    struct primative * lods_out = malloc(lod_count * mesh_count * sizeof(struct primative));
+    float lod_errors[LOD_COUNT_MAX] = {0};
+    float model_extent = 0.0f;
+    
+    for (int mi = 0; mi < mesh_count; mi++) {
+        float dx = verts_out[mi].max.x - verts_out[mi].min.x;
+        float dy = verts_out[mi].max.y - verts_out[mi].min.y;
+        float dz = verts_out[mi].max.z - verts_out[mi].min.z;
+        model_extent = fmaxf(model_extent, sqrtf(dx * dx + dy * dy + dz * dz));
+    }
+    
+    for (int li = 0; li < lod_count; li++) {
+        struct lod_level * lod = lod_levels + li;
+        
+        for (int mi = 0; mi < mesh_count; mi++) {
+            struct primative * lod_out = lods_out + li * mesh_count + mi;
+            
+            uint32_t src_count = inds_out[mi].count;
+            uint32_t max_count = src_count * 3;
+            
+            ind_data = realloc(ind_data, (ind_total + max_count) * sizeof(uint16_t));
+            uint16_t * src = ind_data + inds_out[mi].offset / sizeof(uint16_t);
+            uint16_t * tris = ind_data + ind_total;
+            
+            uint32_t tri_inds;
+            if (prim_type == cgltf_primitive_type_triangle_strip) {
+                tri_inds = strip_to_triangles(src, src_count, tris);
+            } else {
+                memcpy(tris, src, src_count * sizeof(uint16_t));
+                tri_inds = src_count;
+            }
+            
+            float dx = verts_out[mi].max.x - verts_out[mi].min.x;
+            float dy = verts_out[mi].max.y - verts_out[mi].min.y;
+            float dz = verts_out[mi].max.z - verts_out[mi].min.z;
+            float mesh_extent = sqrtf(dx * dx + dy * dy + dz * dz);
+            
+            uint32_t target = (uint32_t)(tri_inds / 3 * lod->ratio) * 3;
+            if (target < 3) target = 3;
+            
+            float error;
+            struct vertex * verts = vert_data + verts_out[mi].offset / verts_stride;
+            lod_out->count = simplify_triangles(verts, verts_out[mi].count, tris, tri_inds,
+                target, lod->error * mesh_extent, &error);
+            
+            lod_out->offset = ind_total * sizeof(uint16_t);
+            lod_out->size = lod_out->count * sizeof(uint16_t);
+            ind_total += lod_out->count;
+            
+            lod_errors[li] = fmaxf(lod_errors[li], error);
+            
+            printf("Mesh %d: LOD %d reduced %d triangles to %d\n", mi, li + 1, tri_inds / 3, lod_out->count / 3);
+        }
+        
+        printf("LOD %d: Ratio %f, Error %f\n", li + 1, lod->ratio, lod_errors[li]);
+    }
+    
+    // These describe the primitives that actually get written out
+    int prim_count = mesh_count;
+    cgltf_primitive_type base_type = prim_type;
+    struct primative * prim_verts = verts_out;
+    struct primative * prim_inds = inds_out;
+    struct primative * prim_lods = lods_out;
+    
+    struct primative merged_verts, merged_inds, merged_lods[LOD_COUNT_MAX];
+    bool merged = false;
+    
+    if (merge_meshes && vert_total > UINT16_MAX) {
+        printf("Too many vertices to merge (%u), keeping one primitive per mesh\n", vert_total);
+    } else if (merge_meshes) {
+        // Every vertex keeps its own joint, so a single triangle list can still animate each part
+        merged = true;
+        uint16_t * merged = malloc(ind_total * 3 * sizeof(uint16_t));
+        uint32_t merged_total = 0;
+        
+        merged_verts = verts_out[0];
+        merged_verts.offset = 0;
+        merged_verts.count = vert_total;
+        merged_verts.size = vert_total * verts_stride;
+        
+        for (int mi = 1; mi < mesh_count; mi++) {
+            merged_verts.min.x = fminf(merged_verts.min.x, verts_out[mi].min.x);
+            merged_verts.min.y = fminf(merged_verts.min.y, verts_out[mi].min.y);
+            merged_verts.min.z = fminf(merged_verts.min.z, verts_out[mi].min.z);
+            
+            merged_verts.max.x = fmaxf(merged_verts.max.x, verts_out[mi].max.x);
+            merged_verts.max.y = fmaxf(merged_verts.max.y, verts_out[mi].max.y);
+            merged_verts.max.z = fmaxf(merged_verts.max.z, verts_out[mi].max.z);
+        }
+        
+        for (int li = -1; li < lod_count; li++) {
+            struct primative * out = li < 0 ? &merged_inds : merged_lods + li;
+            out->offset = merged_total * sizeof(uint16_t);
+            
+            for (int mi = 0; mi < mesh_count; mi++) {
+                struct primative * src = li < 0 ? inds_out + mi : lods_out + li * mesh_count + mi;
+                uint16_t * src_data = ind_data + src->offset / sizeof(uint16_t);
+                uint16_t * dst_data = merged + merged_total;
+                
+                uint32_t count;
+                if (li < 0 && prim_type == cgltf_primitive_type_triangle_strip) {
+                    count = strip_to_triangles(src_data, src->count, dst_data);
+                } else {
+                    memcpy(dst_data, src_data, src->count * sizeof(uint16_t));
+                    count = src->count;
+                }
+                
+                // Rebase the indices onto the shared vertex accessor
+                uint16_t base = verts_out[mi].offset / verts_stride;
+                for (uint32_t i = 0; i < count; i++) dst_data[i] += base;
+                
+                merged_total += count;
+            }
+            
+            out->count = merged_total - out->offset / sizeof(uint16_t);
+            out->size = out->count * sizeof(uint16_t);
+        }
+        
+        printf("Merged %d meshes into one primitive: %u vertices, %u triangles\n", mesh_count, vert_total, merged_inds.count / 3);
+        
+        free(ind_data);
+        ind_data = merged;
+        ind_total = merged_total;
+        
+        prim_count = 1;
+        base_type = cgltf_primitive_type_triangles;
+        prim_verts = &merged_verts;
+        prim_inds = &merged_inds;
+        prim_lods = merged_lods;
+    }
+    
+    // Cluster every written primitive, the base primitives come first followed by each LOD level
+    int cluster_count = build_meshlets ? prim_count * (1 + lod_count) : 0;
+    struct meshlet_list meshlets = {0};
+    uint32_t * meshlet_firsts = malloc(cluster_count * sizeof(uint32_t));
+    uint32_t * meshlet_counts = malloc(cluster_count * sizeof(uint32_t));
+    
+    // Without inverse bind matrices every vertex is in its joint's space, a merged primitive spans
+    // many joints so only its meshlets get bounds
+    struct sphere * prim_bounds = merged ? NULL : malloc(cluster_count * sizeof(struct sphere));
+    
+    for (int pi = 0; pi < cluster_count; pi++) {
+        int li = pi / prim_count - 1;
+        int mi = pi % prim_count;
+        
+        struct primative * src = li < 0 ? prim_inds + mi : prim_lods + li * prim_count + mi;
+        struct vertex * verts = vert_data + prim_verts[mi].offset / verts_stride;
+        
+        uint16_t * src_data = ind_data + src->offset / sizeof(uint16_t);
+        uint16_t * tris = src_data;
+        uint32_t count = src->count;
+        
+        if (li < 0 && base_type == cgltf_primitive_type_triangle_strip) {
+            tris = malloc(count * 3 * sizeof(uint16_t));
+            count = strip_to_triangles(src_data, src->count, tris);
+        }
+        
+        meshlet_firsts[pi] = meshlets.meshlet_count;
+        meshlet_counts[pi] = meshlets_build(verts, prim_verts[mi].count, tris, count, &meshlets);
+        if (prim_bounds) prim_bounds[pi] = bounding_sphere(verts, tris, count);
+        
+        if (tris != src_data) free(tris);
+    }
+    
+    if (build_meshlets) {
+        printf("Built %u meshlets with %u vertex references for %d primitives\n",
+            meshlets.meshlet_count, meshlets.vertex_count, cluster_count);
+    }
+    
+    fwrite(vert_data, sizeof(struct vertex), vert_total, outf);
+    fwrite(ind_data, sizeof(uint16_t), ind_total, outf);
+    
+    uint8_t padding[3] = {0};
+    uint32_t ind_padding = (ind_total * sizeof(uint16_t)) % 4;
+    uint32_t meshlet_vert_padding = (meshlets.vertex_count * sizeof(uint16_t)) % 4;
+    if (build_meshlets) {
+        fwrite(padding, sizeof(uint8_t), ind_padding, outf);
+        fwrite(meshlets.meshlets, sizeof(struct meshlet), meshlets.meshlet_count, outf);
+        fwrite(meshlets.vertices, sizeof(uint16_t), meshlets.vertex_count, outf);
+        fwrite(padding, sizeof(uint8_t), meshlet_vert_padding, outf);
+        fwrite(meshlets.triangles, sizeof(uint8_t), meshlets.triangle_size, outf);
+    }
+    
+    fclose(outf);
+    
     cgltf_options options = {0};
     cgltf_data data = {0};
     
@@ -564,13 +1433,13 @@ int main(int argc, char ** argv) {
     data.asset.generator = strdup("sbmodel");
     data.asset.version = strdup("2.0");
 
-    data.meshes_count = 1;
+    data.meshes_count = 1 + lod_count;
     cgltf_mesh * mesh = data.meshes = calloc(data.meshes_count, sizeof(cgltf_mesh));
     mesh->name = strdup(model_name);
 
     const int accessor_count = 7;
     
-    data.accessors_count = mesh_count * accessor_count;
+    data.accessors_count = prim_count * accessor_count + lod_count * prim_count;
     data.accessors = calloc(data.accessors_count, sizeof(cgltf_accessor));
     
     data.buffers_count = 1;
@@ -581,7 +1450,7 @@ int main(int argc, char ** argv) {
     char * glbin_name = sep ? sep + 1 : path;
     buf->uri = strdup(glbin_name);
 
-    data.buffer_views_count = 2;
+    data.buffer_views_count = build_meshlets ? 5 : 2;
     data.buffer_views = calloc(data.buffer_views_count, sizeof(cgltf_buffer_view));
     
     data.skins_count = 1;
@@ -589,13 +1458,14 @@ int main(int argc, char ** argv) {
     skin->joints_count = node_count;
     skin->joints = malloc(skin->joints_count * sizeof(cgltf_node *));
     
-    data.nodes_count = node_count;
+    data.nodes_count = node_count + lod_count;
     data.nodes = calloc(data.nodes_count, sizeof(cgltf_node));
     
     data.scenes_count = 1;
     cgltf_scene * scene = data.scene = data.scenes = calloc(data.scenes_count, sizeof(cgltf_scene));
 
     scene->name = strdup(model_name);
+    // LOD nodes stay out of the scene, they are only reached through the MSFT_lod ids on the root
     scene->nodes_count = 1;
     scene->nodes = calloc(scene->nodes_count, sizeof(cgltf_node *));
     scene->nodes[0] = data.nodes;
@@ -699,25 +1569,52 @@ int main(int argc, char ** argv) {
     inds_view->buffer = buf;
     inds_view->type = cgltf_buffer_view_type_indices;
 
-    for (int mi = 0; mi < mesh_count; mi++) {
-        verts_view->size += verts_out[mi].size;
-        inds_view->size += inds_out[mi].size;
+    for (int mi = 0; mi < prim_count; mi++) {
+        verts_view->size += prim_verts[mi].size;
+        inds_view->size += prim_inds[mi].size;
+    }
+    
+    for (int li = 0; li < lod_count * prim_count; li++) {
+        inds_view->size += prim_lods[li].size;
     }
 
     inds_view->offset = verts_view->size;
     
     buf->size = verts_view->size + inds_view->size;
     
-    mesh->primitives = calloc(mesh_count, sizeof(cgltf_primitive));
-    mesh->primitives_count = mesh_count;
+    if (build_meshlets) {
+        cgltf_buffer_view * meshlets_view = data.buffer_views + 2;
+        cgltf_buffer_view * meshlet_verts_view = data.buffer_views + 3;
+        cgltf_buffer_view * meshlet_tris_view = data.buffer_views + 4;
+        
+        meshlets_view->name = strdup("Meshlets");
+        meshlets_view->buffer = buf;
+        meshlets_view->offset = buf->size + ind_padding;
+        meshlets_view->size = meshlets.meshlet_count * sizeof(struct meshlet);
+        
+        meshlet_verts_view->name = strdup("Meshlet Vertices");
+        meshlet_verts_view->buffer = buf;
+        meshlet_verts_view->offset = meshlets_view->offset + meshlets_view->size;
+        meshlet_verts_view->size = meshlets.vertex_count * sizeof(uint16_t);
+        
+        meshlet_tris_view->name = strdup("Meshlet Triangles");
+        meshlet_tris_view->buffer = buf;
+        meshlet_tris_view->offset = meshlet_verts_view->offset + meshlet_verts_view->size + meshlet_vert_padding;
+        meshlet_tris_view->size = meshlets.triangle_size;
+        
+        buf->size = meshlet_tris_view->offset + meshlet_tris_view->size;
+    }
     
-    for (int mi = 0; mi < mesh_count; mi++) {
+    mesh->primitives = calloc(prim_count, sizeof(cgltf_primitive));
+    mesh->primitives_count = prim_count;
+    
+    for (int mi = 0; mi < prim_count; mi++) {
         cgltf_primitive * prim = mesh->primitives + mi;
         
         char name[16];
         
         // There's a bug in this cgltf where we need to subtract 1
-        prim->type = prim_type - 1;
+        prim->type = base_type - 1;
         
         const int accessor_pos = mi * accessor_count;
 
@@ -729,28 +1626,28 @@ int main(int argc, char ** argv) {
         
             data.accessors[sio].buffer_view = verts_view;
 
-            data.accessors[sio].offset = verts_out[mi].offset;
+            data.accessors[sio].offset = prim_verts[mi].offset;
             data.accessors[sio].stride = verts_view->stride;
-            data.accessors[sio].count  = verts_out[mi].count;
+            data.accessors[sio].count  = prim_verts[mi].count;
         }
         
         cgltf_accessor * pos_acc = data.accessors + accessor_pos;
         
-        printf("Mesh %d: Offset %ld, Size %d, Count %ld\n", mi, pos_acc->offset, verts_out[mi].size, pos_acc->count);
+        printf("Mesh %d: Offset %ld, Size %d, Count %ld\n", mi, pos_acc->offset, prim_verts[mi].size, pos_acc->count);
         
         snprintf(name, sizeof(name), "Position %d", mi);
         pos_acc->name = strdup(name);
         pos_acc->component_type = cgltf_component_type_r_32f;
         pos_acc->type = cgltf_type_vec3;
         
-        pos_acc->min[0] = verts_out[mi].min.x;
-        pos_acc->min[1] = verts_out[mi].min.y;
-        pos_acc->min[2] = verts_out[mi].min.z;
+        pos_acc->min[0] = prim_verts[mi].min.x;
+        pos_acc->min[1] = prim_verts[mi].min.y;
+        pos_acc->min[2] = prim_verts[mi].min.z;
         pos_acc->has_min = true;
         
-        pos_acc->max[0] = verts_out[mi].max.x;
-        pos_acc->max[1] = verts_out[mi].max.y;
-        pos_acc->max[2] = verts_out[mi].max.z;
+        pos_acc->max[0] = prim_verts[mi].max.x;
+        pos_acc->max[1] = prim_verts[mi].max.y;
+        pos_acc->max[2] = prim_verts[mi].max.z;
         pos_acc->has_max = true;
         
         cgltf_accessor * norm_acc = data.accessors + accessor_pos + 1;
@@ -796,14 +1693,16 @@ int main(int argc, char ** argv) {
         ind_acc->component_type = cgltf_component_type_r_16u;
         ind_acc->type = cgltf_type_scalar;
         
-        ind_acc->offset = inds_out[mi].offset;
+        ind_acc->offset = prim_inds[mi].offset;
         ind_acc->stride = sizeof(uint16_t);
-        ind_acc->count  = inds_out[mi].count;
+        ind_acc->count  = prim_inds[mi].count;
         
         ind_acc->buffer_view = inds_view;
         
         prim->indices = ind_acc;
         
+        if (build_meshlets) prim->extras.data = meshlet_extras(prim_bounds ? prim_bounds + mi : NULL, meshlet_firsts[mi], meshlet_counts[mi]);
+        
         cgltf_attribute * pos_atr = prim->attributes;
         pos_atr->name = strdup("POSITION");
         pos_atr->type = cgltf_attribute_type_position;
@@ -839,6 +1738,78 @@ int main(int argc, char ** argv) {
         }
     }
     
+    // Each LOD gets its own mesh and skinned node, the primitives share the vertex accessors of the base mesh
+    for (int li = 0; li < lod_count; li++) {
+        cgltf_mesh * lod_mesh = data.meshes + 1 + li;
+        cgltf_node * lod_node = data.nodes + node_count + li;
+        
+        char name[80];
+        snprintf(name, sizeof(name), "%s_LOD%d", model_name, li + 1);
+        lod_mesh->name = strdup(name);
+        lod_node->name = strdup(name);
+        
+        lod_node->mesh = lod_mesh;
+        lod_node->skin = skin;
+        
+        lod_mesh->primitives = calloc(prim_count, sizeof(cgltf_primitive));
+        lod_mesh->primitives_count = prim_count;
+        
+        for (int mi = 0; mi < prim_count; mi++) {
+            cgltf_primitive * prim = lod_mesh->primitives + mi;
+            cgltf_primitive * base = mesh->primitives + mi;
+            struct primative * lod_out = prim_lods + li * prim_count + mi;
+            
+            prim->type = cgltf_primitive_type_triangles - 1;
+            
+            prim->attributes_count = base->attributes_count;
+            prim->attributes = calloc(prim->attributes_count, sizeof(cgltf_attribute));
+            for (int ai = 0; ai < prim->attributes_count; ai++) {
+                prim->attributes[ai] = base->attributes[ai];
+                prim->attributes[ai].name = strdup(base->attributes[ai].name);
+            }
+            
+            cgltf_accessor * ind_acc = data.accessors + prim_count * accessor_count + li * prim_count + mi;
+            snprintf(name, sizeof(name), "Indicies %d LOD%d", mi, li + 1);
+            ind_acc->name = strdup(name);
+            ind_acc->component_type = cgltf_component_type_r_16u;
+            ind_acc->type = cgltf_type_scalar;
+            
+            ind_acc->offset = lod_out->offset;
+            ind_acc->stride = sizeof(uint16_t);
+            ind_acc->count  = lod_out->count;
+            
+            ind_acc->buffer_view = inds_view;
+            
+            prim->indices = ind_acc;
+            
+            if (build_meshlets) {
+                int pi = (1 + li) * prim_count + mi;
+                prim->extras.data = meshlet_extras(prim_bounds ? prim_bounds + pi : NULL, meshlet_firsts[pi], meshlet_counts[pi]);
+            }
+        }
+    }
+    
+    if (lod_count) {
+        // Follow the MSFT_lod layout, the screen coverage is where the LOD error reaches about one pixel
+        char lod_extras[256];
+        int lod_len = snprintf(lod_extras, sizeof(lod_extras), "{\"MSFT_lod\": {\"ids\": [");
+        for (int li = 0; li < lod_count; li++) {
+            lod_len += snprintf(lod_extras + lod_len, sizeof(lod_extras) - lod_len, "%s%d", li ? ", " : "", node_count + li);
+        }
+        
+        lod_len += snprintf(lod_extras + lod_len, sizeof(lod_extras) - lod_len, "]}, \"MSFT_screencoverage\": [1.0");
+        float coverage = 1.0f;
+        for (int li = 0; li < lod_count; li++) {
+            float error = model_extent > 0.0f ? lod_errors[li] / model_extent : 0.0f;
+            if (error > 0.0f) coverage = fminf(coverage, 1.0f / (error * lod_screen_height));
+            
+            lod_len += snprintf(lod_extras + lod_len, sizeof(lod_extras) - lod_len, ", %f", coverage);
+        }
+        snprintf(lod_extras + lod_len, sizeof(lod_extras) - lod_len, "]}");
+        
+        data.nodes->extras.data = strdup(lod_extras);
+    }
+    
     cgltf_result result = cgltf_validate(&data);
     if (result != cgltf_result_success) {
 	    fprintf(stderr, "Failed to validate glTF data\n");
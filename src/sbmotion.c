@@ -9,6 +9,9 @@
 #define CGLTF_VALIDATE_ENABLE_ASSERTS 1
 #include "cgltf_write.h"
 
+#include "sha1.h"
+#include "dds.h"
+
 #ifdef __linux__
 #define SEPARATOR '/'
 #include <unistd.h>
@@ -20,14 +23,62 @@
 #endif
 
 const float fps = 20.0f;
-const int animation_stride = 8 * sizeof(float);
 const float scale_factor = 100.0f;
 
+// Keys are only dropped while interpolation reproduces them within these bounds
+float pos_error = 0.0f; // Metres
+float rot_error = 0.0f; // Radians
+
+bool quantize = false; // Rotation outputs as normalized int16
+
+// All keyframes are collected here and appended to the glbin in one go
+uint8_t * keyframes = NULL;
+uint32_t keyframes_size = 0;
+
+uint32_t keys_in = 0, keys_out = 0;
+
+// Animation libraries are shared by every model with the same skeleton
+char * library_dir = NULL;
+
+bool bake_vat = false;
+
+// DDS textures can't be larger than this, every vertex gets its own column and every frame its own row
+#define VAT_WIDTH_MAX 16384
+#define VAT_HEIGHT_MAX 16384
+
+struct vat_track {
+    int joint;
+    struct keyframe * frames;
+    uint32_t count;
+};
+
+struct vat_clip {
+    char * name;
+    struct vat_track * tracks;
+    int track_count;
+    float duration;
+};
+
+struct vat_clip * vat_clips = NULL; // One per animation while baking
+
 struct motion {
     uint32_t offset;
     uint32_t max_frame;
 };
 
+struct lmt_file {
+    char * path;
+    bool mirror;
+    char stem[32];
+    char prefix[32]; // Prepended to clip names when several files are merged
+    
+    FILE * file;
+    uint8_t bone_count;
+    uint8_t motion_count;
+    struct motion * motions;
+    int anim_count;
+};
+
 char * progname;
 
 char path[256];
@@ -47,183 +98,209 @@ void euler2quat(float quat[4], float euler[3]) {
     quat[3] = cx * cy * cz + sx * sy * sz; // W
 }
 
-void realloc_cgltf(cgltf_data * data, int anim_count, int bone_count) {
-    // We're going to need a ton of accessors for this: anim_count * bone_count * 3 (Time, Position, Rotation)
-    cgltf_accessor * accessors = calloc(data->accessors_count + anim_count * bone_count * 3, sizeof(cgltf_accessor));
-    cgltf_buffer_view * buffer_views = calloc(data->buffer_views_count + 1, sizeof(cgltf_buffer_view));
+struct keyframe {
+    float time;
+    float pos[3];
+    float quat[4];
+};
 
-    memcpy(accessors, data->accessors, data->accessors_count * sizeof(cgltf_accessor));
-    memcpy(buffer_views, data->buffer_views, data->buffer_views_count * sizeof(cgltf_buffer_view));
+// Slerp along the shortest path like the runtime does, the result is normalized
+void slerp(const float a[4], const float b[4], float t, float out[4]) {
+    float qb[4];
+    float cosom = 0.0f;
+    for (int i = 0; i < 4; i++) cosom += a[i] * b[i];
+    for (int i = 0; i < 4; i++) qb[i] = cosom < 0.0f ? -b[i] : b[i];
+    cosom = fabsf(cosom);
     
-    for (long i = 0; i < data->accessors_count; i++) {
-        long idx = data->accessors[i].buffer_view - data->buffer_views;
-        accessors[i].buffer_view = buffer_views + idx;
+    float sa = 1.0f - t, sb = t;
+    if (cosom < 0.9995f) {
+        float omega = acosf(cosom);
+        float sinom = sinf(omega);
+        sa = sinf((1.0f - t) * omega) / sinom;
+        sb = sinf(t * omega) / sinom;
     }
     
-    for (long i = 0; i < data->meshes_count; i++) {
-        for (long j = 0; j < data->meshes[i].primitives_count; j++) {
-            long idx = data->meshes[i].primitives[j].indices - data->accessors;
-            data->meshes[i].primitives[j].indices = accessors + idx;
-//            printf("IDX: %ld\n", idx);
-            
-            data->meshes[i].primitives[j].type--; // Fix this stupid bug
-            
-            for (long k = 0; k < data->meshes[i].primitives[j].attributes_count; k++) {
-                idx = data->meshes[i].primitives[j].attributes[k].data - data->accessors;
-                data->meshes[i].primitives[j].attributes[k].index = idx;
-                data->meshes[i].primitives[j].attributes[k].data = accessors + idx;
-//                printf("IDX: %ld\n", idx);
-            }
-        }
+    float len = 0.0f;
+    for (int i = 0; i < 4; i++) {
+        out[i] = a[i] * sa + qb[i] * sb;
+        len += out[i] * out[i];
     }
-
-    free(data->accessors);    
-    free(data->buffer_views);
     
-    data->accessors = accessors;
-    data->buffer_views = buffer_views;
+    len = sqrtf(len);
+    for (int i = 0; i < 4; i++) out[i] /= len;
 }
 
-int main(int argc, char ** argv) {
-    progname = *argv++; argc--;
-
-    printf("SB Motion Tool - By QuantX\n");
-
-    if (argc < 2) {
-        fprintf(stderr, "Please specify a LMT motion file and a glTF model file: %s <path/example.lmt> <path/example.gltf> --mirror\n", progname);
-        return 1;
-    }
+// Distance between a decoded key and the value interpolated for it from two other keys
+float key_error(const struct keyframe * a, const struct keyframe * b, const struct keyframe * k, bool rotation) {
+    float span = b->time - a->time;
+    float t = span > 0.0f ? (k->time - a->time) / span : 0.0f;
     
-    char * path_lmt = *argv++; argc--;
-    char * path_gltf = *argv++; argc--;
-    
-    bool mirror = false;
-    if (argc && !strcmp(*argv, "--mirror")) {
-        *argv++; argc--;
-        mirror = true;
+    if (!rotation) {
+        float d[3];
+        for (int i = 0; i < 3; i++) d[i] = a->pos[i] + (b->pos[i] - a->pos[i]) * t - k->pos[i];
+        return sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
     }
     
-    FILE * lmt = fopen(path_lmt, "rb");
-    if (!lmt) {
-        fprintf(stderr, "Failed to open LMT file: %s\n", path_lmt);
-        return 1;
-    }
+    float q[4];
+    slerp(a->quat, b->quat, t, q);
     
-    uint8_t bone_count;
-    fread(&bone_count, sizeof(uint8_t), 1, lmt);
-    if (!bone_count) {
-        fprintf(stderr, "Bone count was 0 in LMT file\n");
-        fclose(lmt);
-        return 0;
-    }
+    // acosf of the dot is ill-conditioned near identity, take the angle from the vector part of conj(q) * k instead
+    const float * v = k->quat;
+    float dot = q[0] * v[0] + q[1] * v[1] + q[2] * v[2] + q[3] * v[3];
+    float r[3] = {
+        q[3] * v[0] - v[3] * q[0] - (q[1] * v[2] - q[2] * v[1]),
+        q[3] * v[1] - v[3] * q[1] - (q[2] * v[0] - q[0] * v[2]),
+        q[3] * v[2] - v[3] * q[2] - (q[0] * v[1] - q[1] * v[0]),
+    };
     
-    uint8_t motion_count;
-    fread(&motion_count, sizeof(uint8_t), 1, lmt);
-    if (!motion_count) {
-        fprintf(stderr, "Motion count was 0 in LMT file\n");
-        fclose(lmt);
-        return 0;
-    }
+    return 2.0f * atan2f(sqrtf(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]), fabsf(dot));
+}
+
+// Evaluates a decoded track at any time the same way the linear samplers do
+void sample_track(const struct keyframe * frames, uint32_t count, float time, float pos[3], float quat[4]) {
+    uint32_t ki = 0;
+    while (ki + 1 < count && frames[ki + 1].time <= time) ki++;
     
-    int anim_count = motion_count;
-    if (mirror) anim_count *= 2;
+    if (ki + 1 >= count || time <= frames[ki].time) {
+        memcpy(pos, frames[ki].pos, 3 * sizeof(float));
+        memcpy(quat, frames[ki].quat, 4 * sizeof(float));
+        return;
+    }
     
-    printf("Processing %d motions, %d bones\n", motion_count, bone_count);
+    const struct keyframe * a = frames + ki;
+    const struct keyframe * b = frames + ki + 1;
+    float t = (time - a->time) / (b->time - a->time);
     
-    uint16_t unknown;
-    fread(&unknown, sizeof(uint16_t), 1, lmt);
-    if (unknown) printf("Unknown was %04X\n", unknown);
+    for (int i = 0; i < 3; i++) pos[i] = a->pos[i] + (b->pos[i] - a->pos[i]) * t;
+    slerp(a->quat, b->quat, t, quat);
+}
+
+// Keeps the fewest keys that still reproduce every dropped key within the tolerance, returns the kept count
+uint32_t reduce_keys(const struct keyframe * frames, uint32_t count, bool rotation, float tolerance, uint32_t * keep) {
+    if (!count) return 0;
     
-    cgltf_options options = {0};
-    cgltf_data * data = NULL;
-    cgltf_result result = cgltf_parse_file(&options, path_gltf, &data);
-    if (result != cgltf_result_success) {
-        fclose(lmt);
-        fprintf(stderr, "Failed to open glTF file: %s\n", path_gltf);
-        return 1;
-    }
+    uint32_t kept = 0;
+    keep[kept++] = 0;
     
-    if (!data->skins_count) {
-        fprintf(stderr, "No skins defined in glTF file\n");
-        fclose(lmt);
-        cgltf_free(data);
-        return 1;
+    // Constant channels collapse to their first key
+    uint32_t ki;
+    for (ki = 1; ki < count; ki++) {
+        if (key_error(frames, frames, frames + ki, rotation) > tolerance) break;
     }
+    if (ki == count) return kept;
     
-    if (data->animations_count) {
-        fprintf(stderr, "Animation data already present in glTF file\n");
-        fclose(lmt);
-        cgltf_free(data);
-        return 1;
+    uint32_t anchor = 0;
+    for (uint32_t end = 2; end < count; end++) {
+        for (ki = anchor + 1; ki < end; ki++) {
+            if (key_error(frames + anchor, frames + end, frames + ki, rotation) > tolerance) break;
+        }
+        
+        if (ki < end) {
+            anchor = end - 1;
+            keep[kept++] = anchor;
+        }
     }
     
-    cgltf_skin * skin = data->skins;
-    if (bone_count != skin->joints_count) {
-        fprintf(stderr, "Bone count %d does not match count %ld defined in glTF file\n", bone_count, skin->joints_count);
-        fclose(lmt);
-        cgltf_free(data);
-        return 1;
-    }
+    keep[kept++] = count - 1;
+    return kept;
+}
+
+// Keys sit on the fixed fps grid, so channels of one clip often end up with identical times
+cgltf_accessor * emit_times(cgltf_accessor * clip_first, cgltf_accessor ** next, char * name, cgltf_buffer_view * view,
+                            uint8_t * keyframes, uint32_t * offset, const struct keyframe * frames, const uint32_t * keep, uint32_t count) {
+    float * times = (float *)(keyframes + *offset);
+    for (uint32_t ki = 0; ki < count; ki++) times[ki] = frames[keep[ki]].time;
     
-    if (!data->buffers_count) {
-        fprintf(stderr, "No model glbin file defined inside glTF file\n");
-        fclose(lmt);
-        cgltf_free(data);
-        return 1;
+    for (cgltf_accessor * acc = clip_first; acc < *next; acc++) {
+        if (acc->type == cgltf_type_scalar && acc->count == count &&
+            !memcmp(keyframes + acc->offset, times, count * sizeof(float))) return acc;
     }
     
-    realloc_cgltf(data, anim_count, bone_count);
-
-    cgltf_buffer * buf = data->buffers;
-    
-    uint32_t buf_padding = sizeof(float) - (buf->size % sizeof(float));
-    buf->size += buf_padding;
+    cgltf_accessor * acc = (*next)++;
+    acc->name = strdup(name);
+    acc->component_type = cgltf_component_type_r_32f;
+    acc->type = cgltf_type_scalar;
+    acc->buffer_view = view;
+    acc->offset = *offset;
+    acc->count = count;
     
-    cgltf_buffer_view * buf_view = data->buffer_views + data->buffer_views_count;
-    buf_view->name = strdup("Keyframes");
-    buf_view->buffer = buf;
-    buf_view->offset = buf->size;
-    buf_view->stride = animation_stride;
-    buf_view->type = cgltf_buffer_view_type_vertices;
+    acc->min[0] = acc->max[0] = times[0];
+    acc->has_min = true;
+    acc->has_max = true;
     
-    data->buffer_views_count++;
+    for (uint32_t ki = 0; ki < count; ki++) {
+        acc->min[0] = fminf(acc->min[0], times[ki]);
+        acc->max[0] = fmaxf(acc->max[0], times[ki]);
+    }
     
-    strncpy(path, path_gltf, sizeof(path));
-    char * sep = strrchr(path, SEPARATOR);
-    if (sep) strcpy(sep + 1, data->buffers->uri);
-    else strncpy(path, data->buffers->uri, sizeof(path));
+    *offset += count * sizeof(float);
+    return acc;
+}
+
+// Normalized int16 keeps roughly 1/65536 of the range of each channel
+int16_t quantize_snorm(float value) {
+    return (int16_t)lrintf(fmaxf(-1.0f, fminf(1.0f, value)) * 32767.0f);
+}
+
+void realloc_cgltf(cgltf_data * data, int anim_count, int bone_count, int extra_accessors) {
+    // We're going to need a ton of accessors for this: anim_count * bone_count * 4 (Time, Position, Time, Rotation)
+    cgltf_accessor * accessors = calloc(data->accessors_count + anim_count * bone_count * 4 + extra_accessors, sizeof(cgltf_accessor));
+    cgltf_buffer_view * buffer_views = calloc(data->buffer_views_count + 2, sizeof(cgltf_buffer_view)); // Keyframes and VAT lookups
+
+    memcpy(accessors, data->accessors, data->accessors_count * sizeof(cgltf_accessor));
+    memcpy(buffer_views, data->buffer_views, data->buffer_views_count * sizeof(cgltf_buffer_view));
     
-    if (access(path, F_OK)) {
-        fprintf(stderr, "Could not locate %s\n", path);
-        fclose(lmt);
-        cgltf_free(data);
-        return 1;
+    for (long i = 0; i < data->accessors_count; i++) {
+        long idx = data->accessors[i].buffer_view - data->buffer_views;
+        accessors[i].buffer_view = buffer_views + idx;
     }
     
-    FILE * glbin = fopen(path, "ab");
-    if (!glbin) {
-        fprintf(stderr, "Failed to open %s\n", path);
-        fclose(lmt);
-        cgltf_free(data);
-        return 1;
+    for (long i = 0; i < data->meshes_count; i++) {
+        for (long j = 0; j < data->meshes[i].primitives_count; j++) {
+            long idx = data->meshes[i].primitives[j].indices - data->accessors;
+            data->meshes[i].primitives[j].indices = accessors + idx;
+//            printf("IDX: %ld\n", idx);
+            
+            data->meshes[i].primitives[j].type--; // Fix this stupid bug
+            
+            for (long k = 0; k < data->meshes[i].primitives[j].attributes_count; k++) {
+                idx = data->meshes[i].primitives[j].attributes[k].data - data->accessors;
+                data->meshes[i].primitives[j].attributes[k].index = idx;
+                data->meshes[i].primitives[j].attributes[k].data = accessors + idx;
+//                printf("IDX: %ld\n", idx);
+            }
+        }
+    }
+
+    for (long i = 0; i < data->skins_count; i++) {
+        if (data->skins[i].inverse_bind_matrices) {
+            long idx = data->skins[i].inverse_bind_matrices - data->accessors;
+            data->skins[i].inverse_bind_matrices = accessors + idx;
+        }
     }
-    
-    // Add padding bytes as needed to comply with GLTF alignment requirements
-    uint8_t padding[3] = {};
-    fwrite(padding, sizeof(uint8_t), buf_padding, glbin);
 
-    data->animations_count = anim_count;
-    data->animations = calloc(data->animations_count, sizeof(cgltf_animation));
+    free(data->accessors);    
+    free(data->buffer_views);
     
-    struct motion * motions = malloc(motion_count * sizeof(struct motion));
-    fread(motions, sizeof(struct motion), motion_count, lmt);
+    data->accessors = accessors;
+    data->buffer_views = buffer_views;
+}
+
+// Decodes every motion of a LMT file into animations targeting the skin joints of data
+int build_animations(struct lmt_file * lf, cgltf_data * data, cgltf_buffer_view * buf_view, cgltf_animation * anims) {
+    cgltf_skin * skin = data->skins;
+    int bone_count = lf->bone_count;
+    FILE * lmt = lf->file;
+    struct motion * motions = lf->motions;
     
     uint32_t * bones = malloc(bone_count * sizeof(uint32_t));
     
-    uint32_t output_offset = 0;
+    struct keyframe * frames = NULL;
+    uint32_t * keep_pos = NULL;
+    uint32_t * keep_rot = NULL;
     
     int current_anim = 0;
-    for (int mi = 0; mi < motion_count; mi++) {
+    for (int mi = 0; mi < lf->motion_count; mi++) {
         if (ftell(lmt) != motions[mi].offset) {
             fprintf(stderr, "Wrong motion offset %08lX expected %08X\n", ftell(lmt), motions[mi].offset);
             return 1;
@@ -231,13 +308,16 @@ int main(int argc, char ** argv) {
 
         for (int mc = 0; mc < 2; mc++) {
             fseek(lmt, motions[mi].offset, SEEK_SET);
-            
-            cgltf_animation * anim = data->animations + current_anim++;
-            
-            char name[32];
-            snprintf(name, sizeof(name), "Anim_%d", mi);
+        
+            cgltf_animation * anim = anims + current_anim++;
+        
+            char name[64];
+            snprintf(name, sizeof(name), "%sAnim_%d", lf->prefix, mi);
             if (mc) strcat(name, "M");
             anim->name = strdup(name);
+            
+            // Clips without any bone tracks still get a row in the texture
+            if (vat_clips) vat_clips[anim - data->animations].name = anim->name;
 
             // Read bone offsets
             fread(bones, sizeof(uint32_t), bone_count, lmt);
@@ -247,37 +327,37 @@ int main(int argc, char ** argv) {
                 if (bones[bi]) {
                     anim->channels_count += 2;
                     anim->samplers_count += 2;
-                
+            
                     printf(" %08X", bones[bi] + motions[mi].offset);
                 } else printf(" XXXXXXXX");
             }
             printf("\n");
-            
+        
             anim->channels = calloc(anim->channels_count, sizeof(cgltf_animation_channel));
             anim->samplers = calloc(anim->samplers_count, sizeof(cgltf_animation_sampler));
-            
+        
             unsigned int channel = 0;
-            
+            cgltf_accessor * clip_first = data->accessors + data->accessors_count;
+        
             for (int bi = 0; bi < bone_count; bi++) {
                 if (!bones[bi]) continue;
-                
+            
                 uint16_t bone_id;
                 fread(&bone_id, sizeof(uint16_t), 1, lmt);
-                
+            
                 uint16_t frame_count;
                 fread(&frame_count, sizeof(uint16_t), 1, lmt);
-                
                 cgltf_node * bone = skin->joints[bone_id];
-                
+            
                 if (mc) {
                     // Find mirror bone
                     char * bname = strchr(bone->name, ':');
                     if (bname) bname++;
                     else bname = bone->name;
-                    
+                
                     char mname[16];
                     strncpy(mname, bname, sizeof(mname));
-                    
+                
                     char * mep = strchr(mname, '_');
                     if (mep) {
                         bool valid_mbone = false;
@@ -288,16 +368,16 @@ int main(int argc, char ** argv) {
                             mep[1] = 'a';
                             valid_mbone = true;
                         }
-                        
+                    
                         if (valid_mbone) {
                             int mbi;
                             for (mbi = 0; mbi < skin->joints_count; mbi++) {
                                 cgltf_node * mbone = skin->joints[mbi];
-                                
+                            
                                 char * mbone_name = strchr(mbone->name, ':');
                                 if (mbone_name) mbone_name++;
                                 else mbone_name = mbone->name;
-                                
+                            
                                 if (!strncmp(mbone_name, mname, sizeof(mname))) {
                                     bone = mbone;
                                     break;
@@ -310,79 +390,16 @@ int main(int argc, char ** argv) {
                         }
                     }
                 }
-                
+            
                 printf("Reading %d frames for bone: %s\n", frame_count, bone->name);
+            
+                // Decode every frame first, the reducer needs the whole track
+                frames = realloc(frames, frame_count * sizeof(struct keyframe));
                 
-                cgltf_accessor * accs = data->accessors + data->accessors_count;
-
-                snprintf(name, sizeof(name), "Time_%d_%d", mi, bone_id);
-                if (mc) strcat(name, "M");
-                accs[0].name = strdup(name);
-                accs[0].component_type = cgltf_component_type_r_32f;
-                accs[0].type = cgltf_type_scalar;
-                accs[0].buffer_view = buf_view;
-                
-                accs[0].offset = output_offset;
-                accs[0].stride = animation_stride;
-                
-                accs[0].min[0] = 0.0f;
-                accs[0].has_min = true;
-                
-                // accs[0].max[0] is set further down
-                accs[0].has_max = true;
-                
-                snprintf(name, sizeof(name), "Translation_%d_%d", mi, bone_id);
-                if (mc) strcat(name, "M");
-                accs[1].name = strdup(name);
-                accs[1].component_type = cgltf_component_type_r_32f;
-                accs[1].type = cgltf_type_vec3;
-                accs[1].buffer_view = buf_view;
-                
-                accs[1].offset = output_offset + sizeof(float);
-                accs[1].stride = animation_stride;
-                
-                snprintf(name, sizeof(name), "Rotation_%d_%d", mi, bone_id);
-                if (mc) strcat(name, "M");
-                accs[2].name = strdup(name);
-                accs[2].component_type = cgltf_component_type_r_32f;
-                accs[2].type = cgltf_type_vec4;
-                accs[2].buffer_view = buf_view;
-                
-                accs[2].offset = output_offset + (4 * sizeof(float));
-                accs[2].stride = animation_stride;
-                
-                data->accessors_count += 3;
-
-
-                cgltf_animation_sampler * samp = anim->samplers + channel;
-                
-                samp[0].input = accs;
-                samp[0].output = accs + 1;
-                samp[0].interpolation = cgltf_interpolation_type_linear;
-                
-                samp[1].input = accs;
-                samp[1].output = accs + 2;
-                samp[1].interpolation = cgltf_interpolation_type_linear;
-
-                cgltf_animation_channel * chan = anim->channels + channel;
-                
-                chan[0].sampler = samp;
-                chan[0].target_node = bone;
-                chan[0].target_path = cgltf_animation_path_type_translation;
-                
-                chan[1].sampler = samp + 1;
-                chan[1].target_node = bone;
-                chan[1].target_path = cgltf_animation_path_type_rotation;
-                
-                channel += 2;
-                
-                float time_max;
-                
-                uint32_t output_count = 0;
                 for (int fi = 0; fi < frame_count; fi++) {
                     uint16_t frame_index;
                     fread(&frame_index, sizeof(uint16_t), 1, lmt);
-                    
+                
                     if (frame_index != fi) {
                         fprintf(stderr, "Frame index %d does not match actual index %d\n", frame_index, fi);
                         return 1;
@@ -390,64 +407,914 @@ int main(int argc, char ** argv) {
 
                     uint16_t frame_time;
                     fread(&frame_time, sizeof(uint16_t), 1, lmt);
-                    
+                
                     float dir[3];
                     fread(dir, sizeof(float), 3, lmt);
-                    
+                
                     float pos[3];
                     fread(pos, sizeof(float), 3, lmt);
-                    
+                
                     pos[0] /= scale_factor;
                     pos[1] /= scale_factor;
                     pos[2] /= scale_factor;
-
-                    float time = (float)(frame_time) / fps;
-                    if (fi) {
-                        time_max = fmax(time_max, time);
-                    } else {
-                        time_max = time;
-                    }
-                    
+                
                     if (mc) {
                         pos[0] = -pos[0];
-                        
+                    
                         dir[1] = -dir[1];
                         dir[2] = -dir[2];
                     }
-                    
+                
     /*
-                    printf("Bone %d, Frame %d, Time %f, Pos (%f %f %f), Dir (%f %f %f)\n",
-                        bone_id, frame_time, time,
+                    printf("Bone %d, Frame %d, Pos (%f %f %f), Dir (%f %f %f)\n",
+                        bone_id, frame_time,
                         pos[0], pos[1], pos[2],
                         dir[0], dir[1], dir[2]);
     */
-                    float quat[4];
-                    euler2quat(quat, dir);
+                    frames[fi].time = (float)(frame_time) / fps;
+                    memcpy(frames[fi].pos, pos, sizeof(pos));
+                    euler2quat(frames[fi].quat, dir);
+                }
+                
+                if (vat_clips) {
+                    struct vat_clip * clip = vat_clips + (anim - data->animations);
+                    clip->tracks = realloc(clip->tracks, (clip->track_count + 1) * sizeof(struct vat_track));
                     
-                    fwrite(&time, sizeof(float), 1, glbin);
-                    fwrite(pos,   sizeof(float), 3, glbin);
-                    fwrite(quat,  sizeof(float), 4, glbin);
+                    struct vat_track * track = clip->tracks + clip->track_count++;
+                    for (track->joint = 0; skin->joints[track->joint] != bone; track->joint++);
+                    track->count = frame_count;
+                    track->frames = malloc(frame_count * sizeof(struct keyframe));
+                    memcpy(track->frames, frames, frame_count * sizeof(struct keyframe));
                     
-                    output_offset += animation_stride;
-                    output_count++;
+                    for (int fi = 0; fi < frame_count; fi++) clip->duration = fmaxf(clip->duration, frames[fi].time);
+                }
+                
+                keep_pos = realloc(keep_pos, frame_count * sizeof(uint32_t));
+                keep_rot = realloc(keep_rot, frame_count * sizeof(uint32_t));
+                
+                uint32_t pos_count = reduce_keys(frames, frame_count, false, pos_error, keep_pos);
+                uint32_t rot_count = reduce_keys(frames, frame_count, true, rot_error, keep_rot);
+                
+                keys_in += frame_count * 2;
+                keys_out += pos_count + rot_count;
+                
+                // Each channel is tightly packed as its times followed by its values
+                keyframes = realloc(keyframes, keyframes_size + frame_count * (1 + 3 + 1 + 4) * sizeof(float));
+                
+                cgltf_accessor * accs = data->accessors + data->accessors_count;
+                
+                snprintf(name, sizeof(name), "%sTime_%d_%d", lf->prefix, mi, bone_id);
+                if (mc) strcat(name, "M");
+                cgltf_accessor * pos_time = emit_times(clip_first, &accs, name, buf_view, keyframes, &keyframes_size, frames, keep_pos, pos_count);
+                
+                snprintf(name, sizeof(name), "%sTranslation_%d_%d", lf->prefix, mi, bone_id);
+                if (mc) strcat(name, "M");
+                cgltf_accessor * pos_acc = accs++;
+                pos_acc->name = strdup(name);
+                pos_acc->component_type = cgltf_component_type_r_32f;
+                pos_acc->type = cgltf_type_vec3;
+                pos_acc->buffer_view = buf_view;
+                pos_acc->offset = keyframes_size;
+                pos_acc->count = pos_count;
+                
+                cgltf_animation_sampler * samp = anim->samplers + channel;
+                
+                // Translation samplers must stay float in core glTF, only the rotations can be quantized
+                for (uint32_t ki = 0; ki < pos_count; ki++) {
+                    memcpy(keyframes + keyframes_size, frames[keep_pos[ki]].pos, 3 * sizeof(float));
+                    keyframes_size += 3 * sizeof(float);
                 }
                 
-                accs[0].max[0] = time_max;
+                snprintf(name, sizeof(name), "%sRotationTime_%d_%d", lf->prefix, mi, bone_id);
+                if (mc) strcat(name, "M");
+                cgltf_accessor * rot_time = emit_times(clip_first, &accs, name, buf_view, keyframes, &keyframes_size, frames, keep_rot, rot_count);
+                
+                snprintf(name, sizeof(name), "%sRotation_%d_%d", lf->prefix, mi, bone_id);
+                if (mc) strcat(name, "M");
+                cgltf_accessor * rot_acc = accs++;
+                rot_acc->name = strdup(name);
+                rot_acc->component_type = cgltf_component_type_r_32f;
+                rot_acc->type = cgltf_type_vec4;
+                rot_acc->buffer_view = buf_view;
+                rot_acc->offset = keyframes_size;
+                rot_acc->count = rot_count;
                 
-                for (int i = 0; i < 3; i++) {
-                    accs[i].count = output_count;
+                if (quantize) {
+                    rot_acc->component_type = cgltf_component_type_r_16;
+                    rot_acc->normalized = true;
+                    
+                    for (uint32_t ki = 0; ki < rot_count; ki++) {
+                        int16_t * q = (int16_t *)(keyframes + keyframes_size);
+                        for (int c = 0; c < 4; c++) q[c] = quantize_snorm(frames[keep_rot[ki]].quat[c]);
+                        keyframes_size += 4 * sizeof(int16_t);
+                    }
+                } else {
+                    for (uint32_t ki = 0; ki < rot_count; ki++) {
+                        memcpy(keyframes + keyframes_size, frames[keep_rot[ki]].quat, 4 * sizeof(float));
+                        keyframes_size += 4 * sizeof(float);
+                    }
                 }
-            }
+                
+                data->accessors_count = accs - data->accessors;
+            
+                samp[0].input = pos_time;
+                samp[0].output = pos_acc;
+                samp[0].interpolation = cgltf_interpolation_type_linear;
+            
+                samp[1].input = rot_time;
+                samp[1].output = rot_acc;
+                samp[1].interpolation = cgltf_interpolation_type_linear;
+
+                cgltf_animation_channel * chan = anim->channels + channel;
+            
+                chan[0].sampler = samp;
+                chan[0].target_node = bone;
+                chan[0].target_path = cgltf_animation_path_type_translation;
+            
+                chan[1].sampler = samp + 1;
+                chan[1].target_node = bone;
+                chan[1].target_path = cgltf_animation_path_type_rotation;
             
-            if (!mirror) break;
+                channel += 2;
+            }
+        
+            if (!lf->mirror) break;
         }
     }
     
-    buf_view->size = output_offset;
-    buf->size += output_offset;
     
     fclose(lmt);
-    fclose(glbin);
+    free(motions);
+    
+    free(frames);
+    free(keep_pos);
+    free(keep_rot);
+    free(bones);
+    
+    return 0;
+}
+
+// Bone count and joint names (including the mirror IDs) identify a skeleton
+void skeleton_signature(cgltf_skin * skin, char signature[41]) {
+    SHA1_CTX ctx;
+    SHA1Init(&ctx);
+    
+    uint32_t joint_count = skin->joints_count;
+    SHA1Update(&ctx, (unsigned char *)&joint_count, sizeof(uint32_t));
+    
+    for (int ji = 0; ji < skin->joints_count; ji++) {
+        char * name = skin->joints[ji]->name ? skin->joints[ji]->name : "";
+        SHA1Update(&ctx, (unsigned char *)name, strlen(name) + 1);
+    }
+    
+    unsigned char digest[20];
+    SHA1Final(digest, &ctx);
+    
+    for (int i = 0; i < 20; i++) sprintf(signature + i * 2, "%02x", digest[i]);
+}
+
+// Key reduction and quantization change the library contents, so they are part of its name too
+void settings_signature(char signature[41]) {
+    SHA1_CTX ctx;
+    SHA1Init(&ctx);
+    
+    SHA1Update(&ctx, (unsigned char *)&pos_error, sizeof(float));
+    SHA1Update(&ctx, (unsigned char *)&rot_error, sizeof(float));
+    SHA1Update(&ctx, (unsigned char *)&quantize, sizeof(bool));
+    
+    unsigned char digest[20];
+    SHA1Final(digest, &ctx);
+    
+    for (int i = 0; i < 20; i++) sprintf(signature + i * 2, "%02x", digest[i]);
+}
+
+int write_library(struct lmt_file * lf, cgltf_skin * skin, char * lib_name) {
+    cgltf_data lib = {0};
+    
+    lib.asset.generator = strdup("sbmotion");
+    lib.asset.version = strdup("2.0");
+    
+    // The library carries its own copy of the skeleton for the channels to target
+    lib.nodes_count = skin->joints_count;
+    lib.nodes = calloc(lib.nodes_count, sizeof(cgltf_node));
+    
+    for (int ji = 0; ji < skin->joints_count; ji++) {
+        cgltf_node * src = skin->joints[ji];
+        cgltf_node * node = lib.nodes + ji;
+        
+        node->name = strdup(src->name);
+        
+        node->has_translation = src->has_translation;
+        memcpy(node->translation, src->translation, sizeof(node->translation));
+        node->has_rotation = src->has_rotation;
+        memcpy(node->rotation, src->rotation, sizeof(node->rotation));
+        node->has_scale = src->has_scale;
+        memcpy(node->scale, src->scale, sizeof(node->scale));
+        
+        node->children = calloc(src->children_count, sizeof(cgltf_node *));
+        for (int ci = 0; ci < src->children_count; ci++) {
+            for (int cj = 0; cj < skin->joints_count; cj++) {
+                if (skin->joints[cj] != src->children[ci]) continue;
+                
+                node->children[node->children_count++] = lib.nodes + cj;
+                lib.nodes[cj].parent = node;
+            }
+        }
+    }
+    
+    lib.skins_count = 1;
+    lib.skins = calloc(lib.skins_count, sizeof(cgltf_skin));
+    lib.skins->name = strdup(lib_name);
+    lib.skins->joints_count = skin->joints_count;
+    lib.skins->joints = calloc(skin->joints_count, sizeof(cgltf_node *));
+    for (int ji = 0; ji < skin->joints_count; ji++) lib.skins->joints[ji] = lib.nodes + ji;
+    
+    lib.scenes_count = 1;
+    cgltf_scene * scene = lib.scene = lib.scenes = calloc(lib.scenes_count, sizeof(cgltf_scene));
+    scene->nodes = calloc(lib.nodes_count, sizeof(cgltf_node *));
+    for (int ni = 0; ni < lib.nodes_count; ni++) {
+        if (!lib.nodes[ni].parent) scene->nodes[scene->nodes_count++] = lib.nodes + ni;
+    }
+    
+    char uri[96];
+    snprintf(uri, sizeof(uri), "%s.glbin", lib_name);
+    
+    lib.buffers_count = 1;
+    cgltf_buffer * buf = lib.buffers = calloc(lib.buffers_count, sizeof(cgltf_buffer));
+    buf->name = strdup(lib_name);
+    buf->uri = strdup(uri);
+    
+    lib.buffer_views_count = 1;
+    cgltf_buffer_view * buf_view = lib.buffer_views = calloc(lib.buffer_views_count, sizeof(cgltf_buffer_view));
+    buf_view->name = strdup("Keyframes");
+    buf_view->buffer = buf;
+    
+    lib.accessors = calloc(lf->anim_count * lf->bone_count * 4, sizeof(cgltf_accessor));
+    
+    lib.animations_count = lf->anim_count;
+    lib.animations = calloc(lib.animations_count, sizeof(cgltf_animation));
+    
+    keyframes_size = 0;
+    if (build_animations(lf, &lib, buf_view, lib.animations)) return 1;
+    
+    buf_view->size = keyframes_size;
+    buf->size = keyframes_size;
+    
+    snprintf(path, sizeof(path), "%s%c%s", library_dir, SEPARATOR, uri);
+    FILE * glbin = fopen(path, "wb");
+    if (!glbin) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    fwrite(keyframes, sizeof(uint8_t), keyframes_size, glbin);
+    fclose(glbin);
+    
+    // Remove trailing mirror IDs from specials
+    for (int ni = 0; ni < lib.nodes_count; ni++) {
+        char * sep = strchr(lib.nodes[ni].name, ':');
+        if (sep) *sep = '\0';
+    }
+    
+    cgltf_result result = cgltf_validate(&lib);
+    if (result != cgltf_result_success) {
+        fprintf(stderr, "Failed to validate animation library %s\n", lib_name);
+        return 1;
+    }
+    
+    cgltf_options options = {0};
+    snprintf(path, sizeof(path), "%s%c%s.gltf", library_dir, SEPARATOR, lib_name);
+    result = cgltf_write_file(&options, path, &lib);
+    if (result != cgltf_result_success) {
+        fprintf(stderr, "Failed to write animation library %s\n", path);
+        return 1;
+    }
+    
+    printf("Wrote animation library %s\n", path);
+    return 0;
+}
+
+// Writes every LMT once per skeleton into the library directory and references them from the model skin
+int link_libraries(struct lmt_file * lmts, int lmt_count, cgltf_skin * skin) {
+    char signature[41], settings[41];
+    skeleton_signature(skin, signature);
+    settings_signature(settings);
+    
+    char refs[1024];
+    int len = snprintf(refs, sizeof(refs), "{\"animation_library\": {\"signature\": \"%s\", \"files\": [", signature);
+    
+    int lib_count = 0;
+    for (int li = 0; li < lmt_count; li++) {
+        struct lmt_file * lf = lmts + li;
+        if (!lf->anim_count) continue;
+        
+        char lib_name[64];
+        snprintf(lib_name, sizeof(lib_name), "%s%s_%.8s_%.8s", lf->stem, lf->mirror ? "M" : "", signature, settings);
+        
+        snprintf(path, sizeof(path), "%s%c%s.gltf", library_dir, SEPARATOR, lib_name);
+        if (!access(path, F_OK)) {
+            printf("Reusing animation library %s\n", path);
+            fclose(lf->file);
+            free(lf->motions);
+        } else if (write_library(lf, skin, lib_name)) {
+            return 1;
+        }
+        
+        len += snprintf(refs + len, sizeof(refs) - len, "%s\"%s.gltf\"", lib_count++ ? ", " : "", lib_name);
+    }
+    
+    snprintf(refs + len, sizeof(refs) - len, "]}}");
+    skin->extras.data = strdup(refs);
+    
+    return 0;
+}
+
+uint16_t float_to_half(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    
+    if (exponent >= 31) return sign | 0x7C00; // Overflow to infinity
+    
+    if (exponent <= 0) {
+        // Subnormal half
+        if (exponent < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint16_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) half++;
+        return sign | half;
+    }
+    
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) half++; // Rounding may carry into the exponent, which is still correct
+    return half;
+}
+
+// Column major 4x4 multiply, out = a * b
+void mat4_mul(float out[16], const float a[16], const float b[16]) {
+    float m[16];
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            m[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+        }
+    }
+    memcpy(out, m, sizeof(m));
+}
+
+// The mesh of the skinned root node, its vertices become the texture columns
+cgltf_mesh * find_vat_mesh(cgltf_data * data) {
+    for (long ni = 0; ni < data->nodes_count; ni++) {
+        if (data->nodes[ni].skin && data->nodes[ni].mesh) return data->nodes[ni].mesh;
+    }
+    return NULL;
+}
+
+int write_vat_dds(const char * dds_path, const uint16_t * texels, uint32_t width, uint32_t height) {
+    FILE * dds = fopen(dds_path, "wb");
+    if (!dds) {
+        fprintf(stderr, "Failed to open %s\n", dds_path);
+        return 1;
+    }
+    
+    struct dds_header header = DDS_HEADER_INIT;
+    
+    header.width = width;
+    header.height = height;
+    
+    header.flags |= 0x8; // Pitch is provided
+    header.pitch = width * 4 * sizeof(uint16_t);
+    
+    // Enable DX10 header
+    memcpy(header.format.codeStr, "DX10", 4);
+    header.format.flags = 0x4;
+    
+    struct dds_header_dx10 header10 = {
+        .format = 10, // R16G16B16A16F
+        .dimensions = DDS_DX10_DIMENSION_2D,
+        .arraySize = 1,
+    };
+    
+    fputs("DDS ", dds);
+    fwrite(&header, sizeof(struct dds_header), 1, dds);
+    fwrite(&header10, sizeof(struct dds_header_dx10), 1, dds);
+    fwrite(texels, sizeof(uint16_t), (size_t)width * height * 4, dds);
+    
+    fclose(dds);
+    return 0;
+}
+
+/*
+ * Bakes every clip into a pair of vertex animation textures next to the glTF file. Each column is
+ * one vertex of the skinned mesh and each row one frame at the LMT frame rate, clips are stacked
+ * vertically. TEXCOORD_1 on every primitive points at the column of its vertex.
+ */
+int write_vat(cgltf_data * data, cgltf_mesh * mesh, const char * path_gltf, cgltf_buffer_view * anim_view) {
+    cgltf_skin * skin = data->skins;
+    
+    uint32_t width = 0;
+    for (long pi = 0; pi < mesh->primitives_count; pi++) {
+        cgltf_primitive * prim = mesh->primitives + pi;
+        
+        cgltf_accessor * pos_acc = NULL;
+        for (long ai = 0; ai < prim->attributes_count; ai++) {
+            if (prim->attributes[ai].type == cgltf_attribute_type_position) pos_acc = prim->attributes[ai].data;
+        }
+        if (!pos_acc) {
+            fprintf(stderr, "Primitive %ld has no positions\n", pi);
+            return 1;
+        }
+        
+        width += pos_acc->count;
+    }
+    
+    if (width > VAT_WIDTH_MAX) {
+        fprintf(stderr, "%u vertices is too many for a vertex animation texture\n", width);
+        return 1;
+    }
+    
+    uint32_t height = 0;
+    for (long ai = 0; ai < data->animations_count; ai++) {
+        height += (uint32_t)(vat_clips[ai].duration * fps + 0.5f) + 1;
+    }
+    
+    if (height > VAT_HEIGHT_MAX) {
+        fprintf(stderr, "%u frames is too many for a vertex animation texture\n", height);
+        return 1;
+    }
+    
+    // Gather the rigidly bound vertices of all primitives
+    float (*positions)[3] = malloc(width * sizeof(*positions));
+    float (*normals)[3] = malloc(width * sizeof(*normals));
+    uint32_t * joints = malloc(width * sizeof(uint32_t));
+    
+    for (long pi = 0, col = 0; pi < mesh->primitives_count; pi++) {
+        cgltf_primitive * prim = mesh->primitives + pi;
+        
+        cgltf_accessor * pos_acc = NULL, * norm_acc = NULL, * joint_acc = NULL;
+        for (long ai = 0; ai < prim->attributes_count; ai++) {
+            cgltf_attribute * atr = prim->attributes + ai;
+            if (atr->type == cgltf_attribute_type_position) pos_acc = atr->data;
+            else if (!strcmp(atr->name, "NORMAL")) norm_acc = atr->data;
+            else if (!strcmp(atr->name, "JOINTS_0")) joint_acc = atr->data;
+        }
+        
+        for (cgltf_size vi = 0; vi < pos_acc->count; vi++, col++) {
+            cgltf_accessor_read_float(pos_acc, vi, positions[col], 3);
+            
+            normals[col][0] = normals[col][1] = normals[col][2] = 0.0f;
+            if (norm_acc) cgltf_accessor_read_float(norm_acc, vi, normals[col], 3);
+            
+            cgltf_uint joint[4] = {0};
+            if (joint_acc) cgltf_accessor_read_uint(joint_acc, vi, joint, 4);
+            joints[col] = joint[0] < skin->joints_count ? joint[0] : 0;
+        }
+    }
+    
+    float * inverse_binds = malloc(skin->joints_count * 16 * sizeof(float));
+    for (long ji = 0; ji < skin->joints_count; ji++) {
+        float * ibm = inverse_binds + ji * 16;
+        if (skin->inverse_bind_matrices) {
+            cgltf_accessor_read_float(skin->inverse_bind_matrices, ji, ibm, 16);
+        } else {
+            memset(ibm, 0, 16 * sizeof(float));
+            ibm[0] = ibm[5] = ibm[10] = ibm[15] = 1.0f;
+        }
+    }
+    
+    uint16_t * pos_texels = malloc((size_t)width * height * 4 * sizeof(uint16_t));
+    uint16_t * norm_texels = malloc((size_t)width * height * 4 * sizeof(uint16_t));
+    
+    float * locals = malloc(skin->joints_count * 16 * sizeof(float));
+    float * skins = malloc(skin->joints_count * 16 * sizeof(float));
+    
+    // Room for every clip entry, the numbers take at most 10 digits each
+    size_t clips_size = 1;
+    for (long ai = 0; ai < data->animations_count; ai++) clips_size += strlen(vat_clips[ai].name) + 64;
+    
+    char * clips = malloc(clips_size);
+    int clips_len = 0;
+    clips[0] = '\0';
+    
+    uint32_t row = 0;
+    for (long ai = 0; ai < data->animations_count; ai++) {
+        struct vat_clip * clip = vat_clips + ai;
+        uint32_t frame_count = (uint32_t)(clip->duration * fps + 0.5f) + 1;
+        
+        clips_len += snprintf(clips + clips_len, clips_size - clips_len, "%s{\"name\": \"%s\", \"start\": %u, \"frames\": %u}",
+            ai ? ", " : "", clip->name, row, frame_count);
+        
+        for (uint32_t fi = 0; fi < frame_count; fi++, row++) {
+            float time = fi / fps;
+            
+            // Joints without a track keep their rest pose
+            for (long ji = 0; ji < skin->joints_count; ji++) {
+                cgltf_node_transform_local(skin->joints[ji], locals + ji * 16);
+            }
+            
+            for (int ti = 0; ti < clip->track_count; ti++) {
+                struct vat_track * track = clip->tracks + ti;
+                
+                cgltf_node pose = *skin->joints[track->joint];
+                pose.has_translation = pose.has_rotation = true;
+                sample_track(track->frames, track->count, time, pose.translation, pose.rotation);
+                
+                cgltf_node_transform_local(&pose, locals + track->joint * 16);
+            }
+            
+            for (long ji = 0; ji < skin->joints_count; ji++) {
+                float * world = skins + ji * 16;
+                memcpy(world, locals + ji * 16, 16 * sizeof(float));
+                
+                for (cgltf_node * parent = skin->joints[ji]->parent; parent; parent = parent->parent) {
+                    long pj;
+                    for (pj = 0; pj < skin->joints_count && skin->joints[pj] != parent; pj++);
+                    
+                    float parent_local[16];
+                    if (pj < skin->joints_count) memcpy(parent_local, locals + pj * 16, sizeof(parent_local));
+                    else cgltf_node_transform_local(parent, parent_local);
+                    
+                    mat4_mul(world, parent_local, world);
+                }
+                
+                mat4_mul(world, world, inverse_binds + ji * 16);
+            }
+            
+            uint16_t * pos_row = pos_texels + (size_t)row * width * 4;
+            uint16_t * norm_row = norm_texels + (size_t)row * width * 4;
+            
+            for (uint32_t vi = 0; vi < width; vi++) {
+                const float * m = skins + joints[vi] * 16;
+                const float * p = positions[vi];
+                const float * n = normals[vi];
+                
+                float pos[3], norm[3];
+                for (int r = 0; r < 3; r++) {
+                    pos[r] = m[r] * p[0] + m[4 + r] * p[1] + m[8 + r] * p[2] + m[12 + r];
+                    norm[r] = m[r] * n[0] + m[4 + r] * n[1] + m[8 + r] * n[2];
+                }
+                
+                float len = sqrtf(norm[0] * norm[0] + norm[1] * norm[1] + norm[2] * norm[2]);
+                if (len > 0.0f) {
+                    norm[0] /= len;
+                    norm[1] /= len;
+                    norm[2] /= len;
+                }
+                
+                for (int r = 0; r < 3; r++) {
+                    pos_row[vi * 4 + r] = float_to_half(pos[r]);
+                    norm_row[vi * 4 + r] = float_to_half(norm[r]);
+                }
+                pos_row[vi * 4 + 3] = float_to_half(1.0f);
+                norm_row[vi * 4 + 3] = float_to_half(0.0f);
+            }
+        }
+    }
+    
+    char stem[128];
+    const char * base = strrchr(path_gltf, SEPARATOR);
+    strncpy(stem, base ? base + 1 : path_gltf, sizeof(stem) - 1);
+    stem[sizeof(stem) - 1] = '\0';
+    char * ext = strrchr(stem, '.');
+    if (ext) *ext = '\0';
+    
+    char pos_name[160], norm_name[160];
+    snprintf(pos_name, sizeof(pos_name), "%s_vat_pos.dds", stem);
+    snprintf(norm_name, sizeof(norm_name), "%s_vat_norm.dds", stem);
+    
+    // The global path still points at the glbin
+    char dds_path[256];
+    strncpy(dds_path, path_gltf, sizeof(dds_path));
+    char * sep = strrchr(dds_path, SEPARATOR);
+    
+    if (sep) strcpy(sep + 1, pos_name);
+    else strncpy(dds_path, pos_name, sizeof(dds_path));
+    if (write_vat_dds(dds_path, pos_texels, width, height)) return 1;
+    
+    if (sep) strcpy(sep + 1, norm_name);
+    else strncpy(dds_path, norm_name, sizeof(dds_path));
+    if (write_vat_dds(dds_path, norm_texels, width, height)) return 1;
+    
+    printf("Baked %u vertices over %u frames into %s and %s\n", width, height, pos_name, norm_name);
+    
+    // Column lookups are appended after the keyframes in their own view
+    cgltf_buffer_view * uv_view = data->buffer_views + data->buffer_views_count++;
+    uv_view->name = strdup("VAT Lookups");
+    uv_view->buffer = anim_view->buffer;
+    uv_view->offset = anim_view->offset + keyframes_size;
+    uv_view->size = width * 2 * sizeof(float);
+    uv_view->stride = 2 * sizeof(float);
+    uv_view->type = cgltf_buffer_view_type_vertices;
+    
+    keyframes = realloc(keyframes, keyframes_size + uv_view->size);
+    float * uvs = (float *)(keyframes + keyframes_size);
+    keyframes_size += uv_view->size;
+    
+    for (uint32_t vi = 0; vi < width; vi++) {
+        uvs[vi * 2] = (vi + 0.5f) / width;
+        uvs[vi * 2 + 1] = 0.5f / height; // The shader offsets this by the frame row
+    }
+    
+    for (long pi = 0, col = 0; pi < mesh->primitives_count; pi++) {
+        cgltf_primitive * prim = mesh->primitives + pi;
+        
+        cgltf_accessor * pos_acc = NULL;
+        for (long ai = 0; ai < prim->attributes_count; ai++) {
+            if (prim->attributes[ai].type == cgltf_attribute_type_position) pos_acc = prim->attributes[ai].data;
+        }
+        
+        cgltf_accessor * uv_acc = data->accessors + data->accessors_count++;
+        uv_acc->name = strdup("VAT Lookup");
+        uv_acc->component_type = cgltf_component_type_r_32f;
+        uv_acc->type = cgltf_type_vec2;
+        uv_acc->buffer_view = uv_view;
+        uv_acc->offset = col * 2 * sizeof(float);
+        uv_acc->stride = 2 * sizeof(float);
+        uv_acc->count = pos_acc->count;
+        col += pos_acc->count;
+        
+        // LOD primitives reuse the same vertices and so get the same lookups
+        for (long mi = 0; mi < data->meshes_count; mi++) {
+            for (long pj = 0; pj < data->meshes[mi].primitives_count; pj++) {
+                cgltf_primitive * other = data->meshes[mi].primitives + pj;
+                
+                bool shares = false;
+                for (long ai = 0; ai < other->attributes_count; ai++) {
+                    if (other->attributes[ai].data == pos_acc) shares = true;
+                }
+                if (!shares) continue;
+                
+                other->attributes = realloc(other->attributes, (other->attributes_count + 1) * sizeof(cgltf_attribute));
+                cgltf_attribute * uv_atr = other->attributes + other->attributes_count++;
+                memset(uv_atr, 0, sizeof(cgltf_attribute));
+                uv_atr->name = strdup("TEXCOORD_1");
+                uv_atr->type = cgltf_attribute_type_texcoord;
+                uv_atr->index = 1;
+                uv_atr->data = uv_acc;
+            }
+        }
+    }
+    
+    char * extras = malloc(clips_len + 512);
+    sprintf(extras, "{\"vat\": {\"positions\": \"%s\", \"normals\": \"%s\", \"width\": %u, \"height\": %u, \"fps\": %g, \"clips\": [%s]}}",
+        pos_name, norm_name, width, height, fps, clips);
+    mesh->extras.data = extras;
+    
+    free(clips);
+    free(positions);
+    free(normals);
+    free(joints);
+    free(inverse_binds);
+    free(pos_texels);
+    free(norm_texels);
+    free(locals);
+    free(skins);
+    
+    return 0;
+}
+
+int main(int argc, char ** argv) {
+    progname = *argv++; argc--;
+
+    printf("SB Motion Tool - By QuantX\n");
+
+    if (argc < 2) {
+        fprintf(stderr, "Please specify a LMT motion file and a glTF model file: %s <path/example.lmt> <path/example.gltf> --mirror (<path/other.lmt> --mirror ...) (--pos-error <metres>) (--rot-error <degrees>) (--quantize) (--library <dir>) (--vat)\n", progname);
+        return 1;
+    }
+    
+    struct lmt_file * lmts = calloc(argc, sizeof(struct lmt_file));
+    int lmt_count = 0;
+    
+    lmts[lmt_count++].path = *argv++; argc--;
+    char * path_gltf = *argv++; argc--;
+    
+    // Every --mirror applies to the LMT file before it
+    while (argc) {
+        if (!strcmp(*argv, "--mirror")) {
+            lmts[lmt_count - 1].mirror = true;
+        } else if (!strcmp(*argv, "--pos-error") && argc > 1) {
+            argv++; argc--;
+            char * end;
+            pos_error = strtof(*argv, &end);
+            if (end == *argv || *end || !(pos_error >= 0.0f) || isinf(pos_error)) {
+                fprintf(stderr, "Invalid position error '%s', expected a non-negative distance in metres\n", *argv);
+                return 1;
+            }
+        } else if (!strcmp(*argv, "--rot-error") && argc > 1) {
+            argv++; argc--;
+            char * end;
+            rot_error = strtof(*argv, &end) * M_PI / 180.0f;
+            if (end == *argv || *end || !(rot_error >= 0.0f) || isinf(rot_error)) {
+                fprintf(stderr, "Invalid rotation error '%s', expected a non-negative angle in degrees\n", *argv);
+                return 1;
+            }
+        } else if (!strcmp(*argv, "--quantize")) {
+            quantize = true;
+        } else if (!strcmp(*argv, "--library") && argc > 1) {
+            argv++; argc--;
+            library_dir = *argv;
+        } else if (!strcmp(*argv, "--vat")) {
+            bake_vat = true;
+        } else if (!strcmp(*argv, "--pos-error") || !strcmp(*argv, "--rot-error") || !strcmp(*argv, "--library")) {
+            fprintf(stderr, "Option %s needs a value\n", *argv);
+            return 1;
+        } else if (!strncmp(*argv, "--", 2)) {
+            fprintf(stderr, "Unknown option: %s\n", *argv);
+            return 1;
+        } else {
+            lmts[lmt_count++].path = *argv;
+        }
+        argv++; argc--;
+    }
+    
+    if (bake_vat && library_dir) {
+        fprintf(stderr, "Vertex animation textures can only be baked into a model, not a library\n");
+        return 1;
+    }
+    
+    int anim_count = 0;
+    int bone_count = 0;
+    
+    for (int li = 0; li < lmt_count; li++) {
+        struct lmt_file * lf = lmts + li;
+        
+        lf->file = fopen(lf->path, "rb");
+        if (!lf->file) {
+            fprintf(stderr, "Failed to open LMT file: %s\n", lf->path);
+            return 1;
+        }
+        
+        fread(&lf->bone_count, sizeof(uint8_t), 1, lf->file);
+        if (!lf->bone_count) {
+            fprintf(stderr, "Bone count was 0 in LMT file: %s\n", lf->path);
+            continue;
+        }
+        
+        fread(&lf->motion_count, sizeof(uint8_t), 1, lf->file);
+        if (!lf->motion_count) {
+            fprintf(stderr, "Motion count was 0 in LMT file: %s\n", lf->path);
+            continue;
+        }
+        
+        printf("%s: Processing %d motions, %d bones\n", lf->path, lf->motion_count, lf->bone_count);
+        
+        uint16_t unknown;
+        fread(&unknown, sizeof(uint16_t), 1, lf->file);
+        if (unknown) printf("Unknown was %04X\n", unknown);
+        
+        lf->motions = malloc(lf->motion_count * sizeof(struct motion));
+        fread(lf->motions, sizeof(struct motion), lf->motion_count, lf->file);
+        
+        char * stem = strrchr(lf->path, SEPARATOR);
+        strncpy(lf->stem, stem ? stem + 1 : lf->path, sizeof(lf->stem) - 1);
+        char * ext = strrchr(lf->stem, '.');
+        if (ext) *ext = '\0';
+        
+        // Clips are prefixed with the LMT name once there is more than one file in the same glTF
+        if (lmt_count > 1 && !library_dir) {
+            snprintf(lf->prefix, sizeof(lf->prefix), "%s_", lf->stem);
+        }
+        
+        lf->anim_count = lf->mirror ? lf->motion_count * 2 : lf->motion_count;
+        anim_count += lf->anim_count;
+        bone_count = lf->bone_count;
+    }
+    
+    if (!anim_count) return 0;
+    
+    cgltf_options options = {0};
+    cgltf_data * data = NULL;
+    cgltf_result result = cgltf_parse_file(&options, path_gltf, &data);
+    if (result != cgltf_result_success) {
+        fprintf(stderr, "Failed to open glTF file: %s\n", path_gltf);
+        return 1;
+    }
+    
+    if (!data->skins_count) {
+        fprintf(stderr, "No skins defined in glTF file\n");
+        cgltf_free(data);
+        return 1;
+    }
+    
+    if (data->animations_count) {
+        fprintf(stderr, "Animation data already present in glTF file\n");
+        cgltf_free(data);
+        return 1;
+    }
+    
+    cgltf_skin * skin = data->skins;
+    for (int li = 0; li < lmt_count; li++) {
+        if (lmts[li].motion_count && lmts[li].bone_count != skin->joints_count) {
+            fprintf(stderr, "Bone count %d of %s does not match count %ld defined in glTF file\n",
+                lmts[li].bone_count, lmts[li].path, skin->joints_count);
+            cgltf_free(data);
+            return 1;
+        }
+    }
+    
+    if (!data->buffers_count) {
+        fprintf(stderr, "No model glbin file defined inside glTF file\n");
+        cgltf_free(data);
+        return 1;
+    }
+    
+    if (library_dir) {
+        if (skin->extras.data || skin->extras.end_offset > skin->extras.start_offset) {
+            fprintf(stderr, "Skin extras already present in glTF file\n");
+            cgltf_free(data);
+            return 1;
+        }
+        
+        if (link_libraries(lmts, lmt_count, skin)) {
+            cgltf_free(data);
+            return 1;
+        }
+        
+        realloc_cgltf(data, 0, bone_count, 0);
+    } else {
+        cgltf_mesh * vat_mesh = NULL;
+        if (bake_vat) {
+            vat_mesh = find_vat_mesh(data);
+            if (!vat_mesh) {
+                fprintf(stderr, "No skinned mesh to bake a vertex animation texture for\n");
+                cgltf_free(data);
+                return 1;
+            }
+            
+            result = cgltf_load_buffers(&options, data, path_gltf);
+            if (result != cgltf_result_success) {
+                fprintf(stderr, "Failed to load glTF buffers\n");
+                cgltf_free(data);
+                return 1;
+            }
+            
+            vat_clips = calloc(anim_count, sizeof(struct vat_clip));
+        }
+        
+        realloc_cgltf(data, anim_count, bone_count, vat_mesh ? vat_mesh->primitives_count : 0);
+
+        cgltf_buffer * buf = data->buffers;
+    
+        uint32_t buf_padding = sizeof(float) - (buf->size % sizeof(float));
+        buf->size += buf_padding;
+    
+        cgltf_buffer_view * buf_view = data->buffer_views + data->buffer_views_count;
+        buf_view->name = strdup("Keyframes");
+        buf_view->buffer = buf;
+        buf_view->offset = buf->size;
+    
+        data->buffer_views_count++;
+    
+        strncpy(path, path_gltf, sizeof(path));
+        char * sep = strrchr(path, SEPARATOR);
+        if (sep) strcpy(sep + 1, data->buffers->uri);
+        else strncpy(path, data->buffers->uri, sizeof(path));
+    
+        if (access(path, F_OK)) {
+            fprintf(stderr, "Could not locate %s\n", path);
+            cgltf_free(data);
+            return 1;
+        }
+
+        data->animations_count = anim_count;
+        data->animations = calloc(data->animations_count, sizeof(cgltf_animation));
+    
+        cgltf_animation * anims = data->animations;
+        for (int li = 0; li < lmt_count; li++) {
+            if (build_animations(lmts + li, data, buf_view, anims)) return 1;
+            anims += lmts[li].anim_count;
+        }
+    
+        printf("Kept %u of %u keys\n", keys_out, keys_in);
+    
+        buf_view->size = keyframes_size;
+        
+        if (vat_mesh && write_vat(data, vat_mesh, path_gltf, buf_view)) {
+            cgltf_free(data);
+            return 1;
+        }
+        
+        buf->size += keyframes_size;
+    
+        FILE * glbin = fopen(path, "ab");
+        if (!glbin) {
+            fprintf(stderr, "Failed to open %s\n", path);
+            cgltf_free(data);
+            return 1;
+        }
+    
+        // Add padding bytes as needed to comply with GLTF alignment requirements
+        uint8_t padding[sizeof(float)] = {};
+        fwrite(padding, sizeof(uint8_t), buf_padding, glbin);
+        fwrite(keyframes, sizeof(uint8_t), keyframes_size, glbin);
+        fclose(glbin);
+    
+        free(keyframes);
+    }
     
     // Remove trailing mirror IDs from specials
     for (int i = 0; i < skin->joints_count; i++) {
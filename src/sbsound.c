@@ -4,12 +4,18 @@
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "jWrite.h"
 char json_buffer[1<<20]; // 1MB
 
 #ifdef __linux__
 #include <errno.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #define SEPARATOR '/'
@@ -87,7 +93,7 @@ enum xwb_codec {
     XWB_CODEC_UNKNOWN
 };
 const char * xwb_codec_names[] = {"  PCM", "ADPCM", "  WMA", "?????"};
-const char * xwb_codec_exts[] = {"wav", "xwav", "wma", "unknown"};
+const char * xwb_codec_exts[] = {"wav", "wav", "wma", "unknown"}; // ADPCM is decoded to PCM
 
 #define XWB_TRACK_CODEC(format) ((format                    ) & ((1 <<  2) - 1))
 #define XWB_TRACK_CHANS(format) ((format >> (2)             ) & ((1 <<  3) - 1))
@@ -112,10 +118,93 @@ struct wav_header {
     uint16_t extraSize;
 } __attribute__((packed));
 
-struct xadpcm_wav_header {
-    struct wav_header wav;
-    uint16_t nibblesPerBlock; // Always 64
-} __attribute__((packed));
+/*
+ * Xbox ADPCM is IMA ADPCM in blocks of 36 bytes per channel. Each block starts with a 4 byte header
+ * per channel holding the starting sample and step index, followed by 4 bytes of nibbles for each
+ * channel in turn until every channel has 64. The header sample only seeds the predictor.
+ */
+#define XADPCM_BLOCK_SIZE 36
+#define XADPCM_BLOCK_SAMPLES 64
+#define XADPCM_CHANNELS_MAX 8
+
+const int16_t ima_step_table[89] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97,
+    107, 118, 130, 143, 157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724,
+    796, 876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026,
+    4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899, 15289, 16818, 18500,
+    20350, 22385, 24623, 27086, 29794, 32767
+};
+
+const int8_t ima_index_table[16] = {-1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8};
+
+// Every step and nibble worked out up front, decoding a sample is then two lookups and a clamp
+int32_t xadpcm_diff[89][16];
+uint8_t xadpcm_next[89][16];
+
+void xadpcm_init_tables(void) {
+    for (int i = 0; i < 89; i++) {
+        for (int n = 0; n < 16; n++) {
+            int32_t step = ima_step_table[i];
+            int32_t diff = step >> 3;
+            if (n & 4) diff += step;
+            if (n & 2) diff += step >> 1;
+            if (n & 1) diff += step >> 2;
+            xadpcm_diff[i][n] = n & 8 ? -diff : diff;
+            
+            int next = i + ima_index_table[n];
+            xadpcm_next[i][n] = next < 0 ? 0 : next > 88 ? 88 : next;
+        }
+    }
+}
+
+// Decodes whole blocks into interleaved 16 bit samples, all channels of a frame step together
+void decode_xadpcm(const uint8_t * src, uint32_t block_count, uint32_t chans, int16_t * dst) {
+    int32_t pred[XADPCM_CHANNELS_MAX] __attribute__((aligned(16))) = {0};
+    int32_t diff[XADPCM_CHANNELS_MAX] __attribute__((aligned(16))) = {0};
+    uint8_t index[XADPCM_CHANNELS_MAX];
+    
+    for (uint32_t b = 0; b < block_count; b++) {
+        for (uint32_t c = 0; c < chans; c++) {
+            pred[c] = (int16_t)(src[c * 4] | (src[c * 4 + 1] << 8));
+            index[c] = src[c * 4 + 2] > 88 ? 88 : src[c * 4 + 2];
+        }
+        
+        const uint8_t * data = src + chans * 4;
+        for (uint32_t s = 0; s < XADPCM_BLOCK_SAMPLES; s++) {
+            const uint8_t * chunk = data + (s / 8) * chans * 4 + (s % 8) / 2;
+            uint32_t shift = (s & 1) * 4;
+            
+            for (uint32_t c = 0; c < chans; c++) {
+                uint8_t n = (chunk[c * 4] >> shift) & 0xF;
+                diff[c] = xadpcm_diff[index[c]][n];
+                index[c] = xadpcm_next[index[c]][n];
+            }
+            
+#ifdef __SSE2__
+            // The saturating pack is the IMA clamp and interleaves the frame at the same time
+            __m128i lo = _mm_add_epi32(_mm_load_si128((__m128i *)pred), _mm_load_si128((__m128i *)diff));
+            __m128i hi = _mm_add_epi32(_mm_load_si128((__m128i *)(pred + 4)), _mm_load_si128((__m128i *)(diff + 4)));
+            __m128i frame = _mm_packs_epi32(lo, hi);
+            
+            int16_t samples[XADPCM_CHANNELS_MAX] __attribute__((aligned(16)));
+            _mm_store_si128((__m128i *)samples, frame);
+            memcpy(dst, samples, chans * sizeof(int16_t));
+            
+            _mm_store_si128((__m128i *)pred, _mm_srai_epi32(_mm_unpacklo_epi16(frame, frame), 16));
+            _mm_store_si128((__m128i *)(pred + 4), _mm_srai_epi32(_mm_unpackhi_epi16(frame, frame), 16));
+#else
+            for (uint32_t c = 0; c < chans; c++) {
+                int32_t p = pred[c] + diff[c];
+                pred[c] = p < -32768 ? -32768 : p > 32767 ? 32767 : p;
+                dst[c] = pred[c];
+            }
+#endif
+            dst += chans;
+        }
+        
+        src += chans * XADPCM_BLOCK_SIZE;
+    }
+}
 
 struct smpl_header {
     uint32_t manufacturer;
@@ -144,55 +233,364 @@ struct smpl_loop {
     uint32_t iterations;
 };
 
-FILE * open_xwb(char * basepath, char * xwb_name) {
+/*
+ * Four wide helpers for the level meter, SSE2 when available and plain loops otherwise
+ */
+#ifdef __SSE2__
+typedef __m128 vec4;
+
+static inline vec4 v4_load(const float * p) { return _mm_loadu_ps(p); }
+static inline void v4_store(float * p, vec4 a) { _mm_storeu_ps(p, a); }
+static inline vec4 v4_set(float x) { return _mm_set1_ps(x); }
+static inline vec4 v4_add(vec4 a, vec4 b) { return _mm_add_ps(a, b); }
+static inline vec4 v4_sub(vec4 a, vec4 b) { return _mm_sub_ps(a, b); }
+static inline vec4 v4_mul(vec4 a, vec4 b) { return _mm_mul_ps(a, b); }
+static inline vec4 v4_max(vec4 a, vec4 b) { return _mm_max_ps(a, b); }
+static inline vec4 v4_abs(vec4 a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+#else
+typedef struct {
+    float f[4];
+} vec4;
+
+#define V4_LANES(expr) vec4 r; for (int l = 0; l < 4; l++) expr; return r
+static inline vec4 v4_load(const float * p) { V4_LANES(r.f[l] = p[l]); }
+static inline void v4_store(float * p, vec4 a) { memcpy(p, a.f, sizeof(a.f)); }
+static inline vec4 v4_set(float x) { V4_LANES(r.f[l] = x); }
+static inline vec4 v4_add(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] + b.f[l]); }
+static inline vec4 v4_sub(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] - b.f[l]); }
+static inline vec4 v4_mul(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] * b.f[l]); }
+static inline vec4 v4_max(vec4 a, vec4 b) { V4_LANES(r.f[l] = a.f[l] > b.f[l] ? a.f[l] : b.f[l]); }
+static inline vec4 v4_abs(vec4 a) { V4_LANES(r.f[l] = fabsf(a.f[l])); }
+#undef V4_LANES
+#endif
+
+/*
+ * Streaming level meter: EBU R128 integrated loudness, true peak and RMS of a track. Channels are
+ * spread over the lanes of METER_GROUPS vectors and go through the meter one frame at a time.
+ *
+ * Loudness follows BS.1770: K-weighting, 400ms blocks every 100ms, an absolute gate at -70 LUFS and
+ * a relative gate 10 LU below the gated mean. Tracks shorter than a block are measured as a single
+ * block. True peak checks the samples and three points between each pair, interpolated by a
+ * windowed sinc. Levels below LEVEL_FLOOR, including silence, are reported as the floor.
+ */
+#define METER_GROUPS 2
+#define METER_CHANNELS_MAX (METER_GROUPS * 4)
+#define TRUE_PEAK_TAPS 12
+#define TRUE_PEAK_PHASES 4
+#define LEVEL_FLOOR -120.0
+
+struct track_levels {
+    bool measured;
+    double loudness; // LUFS
+    double true_peak; // dBTP
+    double rms; // dBFS
+};
+
+struct meter {
+    uint32_t chans;
+    uint32_t step_length; // Frames in 100ms
+    
+    vec4 shelf_b[3], shelf_a[2]; // K-weighting pre-filter
+    vec4 highpass_b[3], highpass_a[2]; // K-weighting RLB filter
+    vec4 shelf_z[METER_GROUPS][2];
+    vec4 highpass_z[METER_GROUPS][2];
+    vec4 weights[METER_GROUPS];
+    
+    // Each frame is written twice so the last TRUE_PEAK_TAPS frames are always in a row
+    vec4 history[METER_GROUPS][TRUE_PEAK_TAPS * 2];
+    uint32_t history_pos;
+    vec4 taps[TRUE_PEAK_PHASES][TRUE_PEAK_TAPS];
+    vec4 peak[METER_GROUPS];
+    
+    vec4 step_sum[METER_GROUPS]; // K-weighted squares of the current step
+    vec4 raw_sum[METER_GROUPS]; // Plain squares of the current step
+    uint32_t step_frames;
+    double steps[4];
+    uint32_t step_count;
+    
+    double * blocks; // Mean square of each 400ms block
+    size_t block_count;
+    
+    double weighted_total;
+    double raw_total;
+    uint64_t frame_count;
+};
+
+void meter_init(struct meter * m, uint32_t chans, uint32_t rate) {
+    memset(m, 0, sizeof(struct meter));
+    m->chans = chans;
+    m->step_length = rate / 10 ? rate / 10 : 1;
+    
+    // K-weighting filters worked out for the track's rate, as in BS.1770
+    double k = tan(M_PI * 1681.974450955533 / rate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    m->shelf_b[0] = v4_set((vh + vb * k / q + k * k) / a0);
+    m->shelf_b[1] = v4_set(2.0 * (k * k - vh) / a0);
+    m->shelf_b[2] = v4_set((vh - vb * k / q + k * k) / a0);
+    m->shelf_a[0] = v4_set(2.0 * (k * k - 1.0) / a0);
+    m->shelf_a[1] = v4_set((1.0 - k / q + k * k) / a0);
+    
+    k = tan(M_PI * 38.13547087602444 / rate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    m->highpass_b[0] = v4_set(1.0);
+    m->highpass_b[1] = v4_set(-2.0);
+    m->highpass_b[2] = v4_set(1.0);
+    m->highpass_a[0] = v4_set(2.0 * (k * k - 1.0) / a0);
+    m->highpass_a[1] = v4_set((1.0 - k / q + k * k) / a0);
+    
+    // Surrounds of a 5.1 track count more and the LFE not at all
+    float weights[METER_CHANNELS_MAX] = {0};
+    for (uint32_t c = 0; c < chans && c < METER_CHANNELS_MAX; c++) weights[c] = 1.0f;
+    if (chans == 6) {
+        weights[3] = 0.0f;
+        weights[4] = 1.41f;
+        weights[5] = 1.41f;
+    }
+    for (int g = 0; g < METER_GROUPS; g++) m->weights[g] = v4_load(weights + g * 4);
+    
+    // Phase p sits p / TRUE_PEAK_PHASES after the middle of the taps
+    for (int p = 0; p < TRUE_PEAK_PHASES; p++) {
+        double taps[TRUE_PEAK_TAPS], sum = 0.0;
+        for (int j = 0; j < TRUE_PEAK_TAPS; j++) {
+            double d = TRUE_PEAK_TAPS / 2 - 1 - j + (double)p / TRUE_PEAK_PHASES;
+            double sinc = d == 0.0 ? 1.0 : sin(M_PI * d) / (M_PI * d);
+            double window = 0.5 * (1.0 + cos(M_PI * d / (TRUE_PEAK_TAPS / 2)));
+            taps[j] = sinc * window;
+            sum += taps[j];
+        }
+        for (int j = 0; j < TRUE_PEAK_TAPS; j++) m->taps[p][j] = v4_set(taps[j] / sum);
+    }
+}
+
+static inline vec4 biquad(vec4 x, const vec4 b[3], const vec4 a[2], vec4 z[2]) {
+    vec4 y = v4_add(v4_mul(b[0], x), z[0]);
+    z[0] = v4_add(v4_sub(v4_mul(b[1], x), v4_mul(a[0], y)), z[1]);
+    z[1] = v4_sub(v4_mul(b[2], x), v4_mul(a[1], y));
+    return y;
+}
+
+static double horizontal_sum(const vec4 v[METER_GROUPS]) {
+    float lanes[METER_CHANNELS_MAX];
+    for (int g = 0; g < METER_GROUPS; g++) v4_store(lanes + g * 4, v[g]);
+    
+    double sum = 0.0;
+    for (int c = 0; c < METER_CHANNELS_MAX; c++) sum += lanes[c];
+    return sum;
+}
+
+void meter_feed(struct meter * m, const int16_t * pcm, size_t frame_count) {
+    uint32_t chans = m->chans < METER_CHANNELS_MAX ? m->chans : METER_CHANNELS_MAX;
+    
+    for (size_t f = 0; f < frame_count; f++) {
+        float samples[METER_CHANNELS_MAX] = {0};
+        for (uint32_t c = 0; c < chans; c++) samples[c] = pcm[f * m->chans + c] * (1.0f / 32768.0f);
+        
+        uint32_t pos = m->history_pos;
+        m->history_pos = (pos + 1) % TRUE_PEAK_TAPS;
+        
+        for (int g = 0; g < METER_GROUPS; g++) {
+            vec4 x = v4_load(samples + g * 4);
+            
+            vec4 k = biquad(x, m->shelf_b, m->shelf_a, m->shelf_z[g]);
+            k = biquad(k, m->highpass_b, m->highpass_a, m->highpass_z[g]);
+            m->step_sum[g] = v4_add(m->step_sum[g], v4_mul(k, k));
+            m->raw_sum[g] = v4_add(m->raw_sum[g], v4_mul(x, x));
+            
+            vec4 * history = m->history[g];
+            history[pos] = x;
+            history[pos + TRUE_PEAK_TAPS] = x;
+            history += pos + 1;
+            
+            vec4 peak = v4_max(m->peak[g], v4_abs(x));
+            for (int p = 1; p < TRUE_PEAK_PHASES; p++) {
+                vec4 y = v4_mul(history[0], m->taps[p][0]);
+                for (int j = 1; j < TRUE_PEAK_TAPS; j++) y = v4_add(y, v4_mul(history[j], m->taps[p][j]));
+                peak = v4_max(peak, v4_abs(y));
+            }
+            m->peak[g] = peak;
+        }
+        
+        if (++m->step_frames < m->step_length) continue;
+        
+        // A step is done, the last four make a block
+        vec4 weighted[METER_GROUPS];
+        for (int g = 0; g < METER_GROUPS; g++) weighted[g] = v4_mul(m->step_sum[g], m->weights[g]);
+        
+        double step = horizontal_sum(weighted);
+        m->weighted_total += step;
+        m->raw_total += horizontal_sum(m->raw_sum);
+        m->frame_count += m->step_frames;
+        
+        m->steps[m->step_count++ % 4] = step;
+        if (m->step_count >= 4) {
+            if (!(m->block_count % 256)) m->blocks = realloc(m->blocks, (m->block_count + 256) * sizeof(double));
+            m->blocks[m->block_count++] = (m->steps[0] + m->steps[1] + m->steps[2] + m->steps[3]) / (4.0 * m->step_length);
+        }
+        
+        for (int g = 0; g < METER_GROUPS; g++) {
+            m->step_sum[g] = v4_set(0.0f);
+            m->raw_sum[g] = v4_set(0.0f);
+        }
+        m->step_frames = 0;
+    }
+}
+
+static double level_db(double value, double scale) {
+    double db = value > 0.0 ? scale * log10(value) : LEVEL_FLOOR;
+    return db < LEVEL_FLOOR ? LEVEL_FLOOR : db;
+}
+
+void meter_finish(struct meter * m, struct track_levels * levels) {
+    // Whatever is left of the last step still counts for the totals
+    vec4 weighted[METER_GROUPS];
+    for (int g = 0; g < METER_GROUPS; g++) weighted[g] = v4_mul(m->step_sum[g], m->weights[g]);
+    m->weighted_total += horizontal_sum(weighted);
+    m->raw_total += horizontal_sum(m->raw_sum);
+    m->frame_count += m->step_frames;
+    
+    if (!m->block_count && m->frame_count) {
+        m->blocks = malloc(sizeof(double));
+        m->blocks[m->block_count++] = m->weighted_total / m->frame_count;
+    }
+    
+    // Gated means, the block loudness is -0.691 + 10 log10 of its mean square
+    double absolute_gate = pow(10.0, (-70.0 + 0.691) / 10.0);
+    double sum = 0.0;
+    size_t count = 0;
+    for (size_t b = 0; b < m->block_count; b++) {
+        if (m->blocks[b] <= absolute_gate) continue;
+        sum += m->blocks[b];
+        count++;
+    }
+    
+    double relative_gate = count ? sum / count * pow(10.0, -10.0 / 10.0) : 0.0;
+    sum = 0.0;
+    count = 0;
+    for (size_t b = 0; b < m->block_count; b++) {
+        if (m->blocks[b] <= absolute_gate || m->blocks[b] <= relative_gate) continue;
+        sum += m->blocks[b];
+        count++;
+    }
+    
+    float peaks[METER_CHANNELS_MAX];
+    for (int g = 0; g < METER_GROUPS; g++) v4_store(peaks + g * 4, m->peak[g]);
+    double peak = 0.0;
+    for (int c = 0; c < METER_CHANNELS_MAX; c++) peak = peaks[c] > peak ? peaks[c] : peak;
+    
+    levels->measured = true;
+    levels->loudness = count ? level_db(sum / count, 10.0) - 0.691 : LEVEL_FLOOR;
+    if (levels->loudness < LEVEL_FLOOR) levels->loudness = LEVEL_FLOOR;
+    levels->true_peak = level_db(peak, 20.0);
+    levels->rms = m->frame_count ? level_db(m->raw_total / ((double)m->frame_count * m->chans), 10.0) : LEVEL_FLOOR;
+    
+    free(m->blocks);
+    m->blocks = NULL;
+}
+
+/*
+ * A wavebank read into memory once, the track headers and payloads are all taken from there
+ */
+struct xwb {
+    char * name; // From the XSB string table
+    uint8_t * data;
+    size_t size;
+    struct xwb_region segments[4];
+    char bank_name[16];
+    uint32_t track_count;
+    struct xwb_track * tracks;
+    char ** track_names;
+    float * track_lfe; // Linear LFE volume of the loudest sound playing each track
+    struct track_levels * track_levels; // Measured from the extracted samples
+};
+
+int load_xwb(char * basepath, char * xwb_name, struct xwb * xwb) {
     char path[256];
     snprintf(path, sizeof(path), "%s%s.xwb", basepath, xwb_name);
 
-    FILE * xwb = fopen(path, "rb");
+    FILE * xwbf = fopen(path, "rb");
     // Try again with a slightly different filename
-    if (!xwb && xwb_name[0] >= 'A' && xwb_name[0] <= 'Z') {
+    if (!xwbf && xwb_name[0] >= 'A' && xwb_name[0] <= 'Z') {
         xwb_name[0] += 32;
         snprintf(path, sizeof(path), "%s%s.xwb", basepath, xwb_name);
-        xwb = fopen(path, "rb");
+        xwbf = fopen(path, "rb");
     }
     
-    if (!xwb) {
+    if (!xwbf) {
         fprintf(stderr, "Failed to open XWB: %s\n", path);
-        return NULL;
+        return 1;
     }
     
-    char magic[4];
-    fread(magic, sizeof(char), 4, xwb);
+    fseek(xwbf, 0, SEEK_END);
+    xwb->size = ftell(xwbf);
+    fseek(xwbf, 0, SEEK_SET);
+    
+    xwb->name = xwb_name;
+    xwb->data = malloc(xwb->size);
+    size_t read = fread(xwb->data, 1, xwb->size, xwbf);
+    fclose(xwbf);
     
-    if (strncmp(magic, "WBND", 4)) {
-        fclose(xwb);
+    if (read != xwb->size || xwb->size < 8 + sizeof(xwb->segments) || strncmp((char *)xwb->data, "WBND", 4)) {
         fprintf(stderr, "Not an XWB wavebank: %s\n", path);
-        return NULL;
+        return 1;
     }
     
     uint32_t version;
-    fread(&version, sizeof(uint32_t), 1, xwb);
+    memcpy(&version, xwb->data + 4, sizeof(uint32_t));
     
     if (version != 3) {
-        fclose(xwb);
         fprintf(stderr, "Unsupported XWB version %d: %s\n", version, path);
-        return NULL;
+        return 1;
     }
     
-    return xwb;
-}
-
-int get_xwb_track_count(char * basepath, char * xwb_name) {
-    FILE * xwb = open_xwb(basepath, xwb_name);
-    if (!xwb) return -1;
+    memcpy(xwb->segments, xwb->data + 8, sizeof(xwb->segments));
     
-    fseek(xwb, 0x2C, SEEK_SET);
+    // Wavebank data: flags, track count, name, track header size, track name size, alignment
+    uint32_t bank_data[7];
+    if (xwb->segments[0].pos + sizeof(bank_data) > xwb->size) {
+        fprintf(stderr, "Wavebank data is out of bounds: %s\n", path);
+        return 1;
+    }
+    memcpy(bank_data, xwb->data + xwb->segments[0].pos, sizeof(bank_data));
     
-    int32_t track_count;
-    fread(&track_count, sizeof(uint32_t), 1, xwb);
-    fclose(xwb);
+    uint32_t flags = bank_data[0];
+    if (flags != 0 && flags != 1) {
+        fprintf(stderr, "Unknown flag configuration %08X\n", flags);
+        return 1;
+    }
+    
+    xwb->track_count = bank_data[1];
+    memcpy(xwb->bank_name, bank_data + 2, sizeof(xwb->bank_name));
+    
+    uint32_t track_header_size = bank_data[6];
+    if (track_header_size != sizeof(struct xwb_track)) {
+        fprintf(stderr, "Invalid track entry header size %d != %ld\n", track_header_size, sizeof(struct xwb_track));
+        return 1;
+    }
     
-    return track_count;
+    if (xwb->segments[1].pos + (size_t)xwb->track_count * sizeof(struct xwb_track) > xwb->size) {
+        fprintf(stderr, "Track headers are out of bounds: %s\n", path);
+        return 1;
+    }
+    
+    xwb->tracks = malloc(xwb->track_count * sizeof(struct xwb_track));
+    memcpy(xwb->tracks, xwb->data + xwb->segments[1].pos, xwb->track_count * sizeof(struct xwb_track));
+    xwb->track_names = calloc(xwb->track_count, sizeof(char *));
+    xwb->track_lfe = calloc(xwb->track_count, sizeof(float));
+    xwb->track_levels = calloc(xwb->track_count, sizeof(struct track_levels));
+    
+    return 0;
+}
+
+void free_xwb(struct xwb * xwb) {
+    free(xwb->data);
+    free(xwb->tracks);
+    free(xwb->track_names);
+    free(xwb->track_lfe);
+    free(xwb->track_levels);
 }
 
 int write_wav_header(FILE * fd, struct wav_header * header, uint32_t data_size, uint32_t loop_count) {
@@ -239,54 +637,130 @@ int write_smpl_chunk(FILE * fd, struct xwb_track * track) {
     fwrite(&loop, sizeof(struct smpl_loop), 1, fd);
 }
 
-int decode_xwb(char * basepath, char * xwb_name, char ** track_names) {
-    FILE * xwb = open_xwb(basepath, xwb_name);
-    if (!xwb) return 1;
+// Measures a whole track of 16 bit samples
+void measure_track(struct xwb * xwb, uint32_t i, const int16_t * pcm, uint32_t chans, size_t frame_count) {
+    struct meter * m = malloc(sizeof(struct meter));
+    meter_init(m, chans, XWB_TRACK_RATE(xwb->tracks[i].format));
+    meter_feed(m, pcm, frame_count);
+    meter_finish(m, xwb->track_levels + i);
+    free(m);
+}
 
-    struct xwb_region segments[4];
-    fread(segments, sizeof(struct xwb_region), 4, xwb);
-    
-    fseek(xwb, segments[0].pos, SEEK_SET); // Read wavebank data
+/*
+ * 5.1 tracks are mixed down to stereo since the runtime can't play them, the channels come in the
+ * WAV order FL, FR, C, LFE, SL, SR. Centre and surround levels can be set on the command line and
+ * the LFE level is scaled by the LFE volume of the loudest sound playing the track. When a row adds
+ * up to more than 1 both are scaled down together so the mix can't clip.
+ */
+#define DOWNMIX_CHANNELS 6
+
+bool downmix = true;
+float downmix_center = 0.7071f;
+float downmix_surround = 0.7071f;
+float downmix_lfe = 0.5f;
+
+// Q15 coefficients for the left and right output, two spare lanes so a frame fills a vector
+void downmix_coefs(float lfe_volume, int16_t coef_l[8], int16_t coef_r[8]) {
+    float lfe = downmix_lfe * lfe_volume;
+    float l[DOWNMIX_CHANNELS] = {1.0f, 0.0f, downmix_center, lfe, downmix_surround, 0.0f};
+    float r[DOWNMIX_CHANNELS] = {0.0f, 1.0f, downmix_center, lfe, 0.0f, downmix_surround};
     
-    uint32_t flags;
-    fread(&flags, sizeof(uint32_t), 1, xwb);
+    float sum = 1.0f + fabsf(downmix_center) + fabsf(lfe) + fabsf(downmix_surround);
+    float scale = sum > 1.0f ? 1.0f / sum : 1.0f;
     
-    if (flags != 0 && flags != 1) {
-        fclose(xwb);
-        fprintf(stderr, "Unknown flag configuration %08X\n", flags);
-        return 1;
+    memset(coef_l, 0, sizeof(int16_t) * 8);
+    memset(coef_r, 0, sizeof(int16_t) * 8);
+    for (int c = 0; c < DOWNMIX_CHANNELS; c++) {
+        coef_l[c] = lroundf(l[c] * scale * 32767.0f);
+        coef_r[c] = lroundf(r[c] * scale * 32767.0f);
     }
+}
+
+void downmix_51(const int16_t * src, size_t frame_count, const int16_t coef_l[8], const int16_t coef_r[8],
+    int16_t * dst) {
     
-    uint32_t track_count;
-    fread(&track_count, sizeof(uint32_t), 1, xwb);
-    
-    char bank_name[16];
-    fread(bank_name, sizeof(char), 16, xwb);
+    size_t f = 0;
+#ifdef __SSE2__
+    const __m128i cl = _mm_loadu_si128((const __m128i *)coef_l);
+    const __m128i cr = _mm_loadu_si128((const __m128i *)coef_r);
+    const __m128i round = _mm_set1_epi32(1 << 14);
     
-    printf("Unpacking wavebank: Name \"%.16s\", Tracks %d\n", bank_name, track_count);
+    // Every frame is loaded as 8 samples, the last frames are left to the scalar loop so no load
+    // reads past the end
+    for (; f + 5 <= frame_count; f += 4) {
+        __m128i l[4], r[4];
+        for (int k = 0; k < 4; k++) {
+            __m128i frame = _mm_loadu_si128((const __m128i *)(src + (f + k) * DOWNMIX_CHANNELS));
+            l[k] = _mm_madd_epi16(frame, cl);
+            r[k] = _mm_madd_epi16(frame, cr);
+        }
+        
+        // Transpose and add so lane k holds the whole sum for frame k
+        __m128i l01 = _mm_add_epi32(_mm_unpacklo_epi32(l[0], l[1]), _mm_unpackhi_epi32(l[0], l[1]));
+        __m128i l23 = _mm_add_epi32(_mm_unpacklo_epi32(l[2], l[3]), _mm_unpackhi_epi32(l[2], l[3]));
+        __m128i r01 = _mm_add_epi32(_mm_unpacklo_epi32(r[0], r[1]), _mm_unpackhi_epi32(r[0], r[1]));
+        __m128i r23 = _mm_add_epi32(_mm_unpacklo_epi32(r[2], r[3]), _mm_unpackhi_epi32(r[2], r[3]));
+        __m128i ls = _mm_add_epi32(_mm_unpacklo_epi64(l01, l23), _mm_unpackhi_epi64(l01, l23));
+        __m128i rs = _mm_add_epi32(_mm_unpacklo_epi64(r01, r23), _mm_unpackhi_epi64(r01, r23));
+        
+        ls = _mm_srai_epi32(_mm_add_epi32(ls, round), 15);
+        rs = _mm_srai_epi32(_mm_add_epi32(rs, round), 15);
+        
+        __m128i out = _mm_packs_epi32(_mm_unpacklo_epi32(ls, rs), _mm_unpackhi_epi32(ls, rs));
+        _mm_storeu_si128((__m128i *)(dst + f * 2), out);
+    }
+#endif
+    for (; f < frame_count; f++) {
+        int32_t l = 0, r = 0;
+        for (int c = 0; c < DOWNMIX_CHANNELS; c++) {
+            l += src[f * DOWNMIX_CHANNELS + c] * coef_l[c];
+            r += src[f * DOWNMIX_CHANNELS + c] * coef_r[c];
+        }
+        l = (l + (1 << 14)) >> 15;
+        r = (r + (1 << 14)) >> 15;
+        dst[f * 2] = l < -32768 ? -32768 : l > 32767 ? 32767 : l;
+        dst[f * 2 + 1] = r < -32768 ? -32768 : r > 32767 ? 32767 : r;
+    }
+}
+
+// Writes 16 bit samples as a PCM WAV, 5.1 gets mixed down on the way
+void write_pcm16(FILE * out, struct xwb * xwb, uint32_t i, const int16_t * pcm, uint32_t chans, uint32_t frame_count,
+    bool loops) {
     
-    uint32_t track_header_size;
-    fread(&track_header_size, sizeof(uint32_t), 1, xwb);
+    struct xwb_track * track = xwb->tracks + i;
+    int16_t * stereo = NULL;
     
-    if (track_header_size != sizeof(struct xwb_track)) {
-        fclose(xwb);
-        fprintf(stderr, "Invalid track entry header size %d != %ld\n", track_header_size, sizeof(struct xwb_track));
-        return 1;
+    if (downmix && chans == DOWNMIX_CHANNELS) {
+        int16_t coef_l[8], coef_r[8];
+        downmix_coefs(xwb->track_lfe[i], coef_l, coef_r);
+        
+        stereo = malloc(frame_count * 2 * sizeof(int16_t));
+        downmix_51(pcm, frame_count, coef_l, coef_r, stereo);
+        
+        pcm = stereo;
+        chans = 2;
     }
     
-    uint32_t track_name_size;
-    fread(&track_name_size, sizeof(uint32_t), 1, xwb);
+    uint32_t rate = XWB_TRACK_RATE(track->format);
+    struct wav_header header = {0x0001, chans, rate};
+    header.blockAlign = chans * sizeof(int16_t);
+    header.avgBytesPerSec = header.blockAlign * rate;
+    header.bitsPerSample = 16;
+    
+    write_wav_header(out, &header, frame_count * header.blockAlign, loops);
+    fwrite(pcm, header.blockAlign, frame_count, out);
     
-    uint32_t alignment;
-    fread(&alignment, sizeof(uint32_t), 1, xwb);
+    measure_track(xwb, i, pcm, chans, frame_count);
     
-    fseek(xwb, segments[1].pos, SEEK_SET); // Read track headers
+    free(stereo);
+}
 
-    struct xwb_track tracks[track_count];
-    fread(tracks, sizeof(struct xwb_track), track_count, xwb);
+// Lists the tracks of a bank and creates its output directory, loop regions are turned into blocks here
+int prepare_xwb(char * basepath, struct xwb * xwb) {
+    printf("Unpacking wavebank: Name \"%.16s\", Tracks %d\n", xwb->bank_name, xwb->track_count);
     
-    for (int i = 0; i < track_count; i++) {
-        struct xwb_track * track = tracks + i;
+    for (uint32_t i = 0; i < xwb->track_count; i++) {
+        struct xwb_track * track = xwb->tracks + i;
         
         enum xwb_codec codec = XWB_TRACK_CODEC(track->format);
         uint32_t chans = XWB_TRACK_CHANS(track->format);
@@ -298,12 +772,12 @@ int decode_xwb(char * basepath, char * xwb_name, char ** track_names) {
         const char * codec_name = xwb_codec_names[codec];
         
         char name_guess[64];
-        snprintf(name_guess, sizeof(name_guess), "%s_track_%d", bank_name, i);
+        snprintf(name_guess, sizeof(name_guess), "%.16s_track_%d", xwb->bank_name, i);
         
-        char * name = track_names[i];
+        char * name = xwb->track_names[i];
         if (!name) name = name_guess;
         
-        uint32_t blockAlign = chans * (codec == XWB_CODEC_PCM ? bits / 8 : 36);
+        uint32_t blockAlign = chans * (codec == XWB_CODEC_PCM ? bits / 8 : XADPCM_BLOCK_SIZE);
         
         track->loop.pos /= blockAlign;
         track->loop.len /= blockAlign;
@@ -312,79 +786,201 @@ int decode_xwb(char * basepath, char * xwb_name, char ** track_names) {
             i, codec_name, chans, rate, align, bits,
             track->loop.pos, track->loop.len,
             name);
-        
-        if (codec == XWB_CODEC_UNKNOWN) continue;
-        
-        char path[256];
-        snprintf(path, sizeof(path), "%s%s%c", basepath, xwb_name, SEPARATOR);
-        
+    }
+    
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s%c", basepath, xwb->name, SEPARATOR);
+    
 #ifdef __linux__
-        if (mkdir(path, 0777) < 0 && errno != EEXIST) {
+    if (mkdir(path, 0777) < 0 && errno != EEXIST) {
 #else
-        if (!CreateDirectory(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
+    if (!CreateDirectory(path, NULL) && GetLastError() != ERROR_ALREADY_EXISTS) {
 #endif
-            fprintf(stderr, "Failed to create output directory: %s\n", path);
-            fclose(xwb);
-            return 1;
+        fprintf(stderr, "Failed to create output directory: %s\n", path);
+        return 1;
+    }
+    
+    return 0;
+}
+
+// Writes a single track out of its bank, safe to run for different tracks at the same time
+int extract_track(char * basepath, struct xwb * xwb, uint32_t i) {
+    struct xwb_track * track = xwb->tracks + i;
+    
+    enum xwb_codec codec = XWB_TRACK_CODEC(track->format);
+    uint32_t chans = XWB_TRACK_CHANS(track->format);
+    uint32_t rate  = XWB_TRACK_RATE(track->format);
+    uint32_t bits  = XWB_TRACK_BITS(track->format) ? 16 : 8;
+    
+    if (codec >= XWB_CODEC_UNKNOWN) return 0;
+    
+    char name_guess[64];
+    snprintf(name_guess, sizeof(name_guess), "%.16s_track_%d", xwb->bank_name, i);
+    
+    char * name = xwb->track_names[i];
+    if (!name) name = name_guess;
+    
+    uint32_t blockAlign = chans * (codec == XWB_CODEC_PCM ? bits / 8 : XADPCM_BLOCK_SIZE);
+    
+    // Payloads running past the end of the bank are cut short
+    size_t start = (size_t)xwb->segments[3].pos + track->play.pos;
+    size_t length = track->play.len;
+    if (start > xwb->size) start = xwb->size;
+    if (length > xwb->size - start) {
+        fprintf(stderr, "Unexpected EOF in track %d of %s\n", i, xwb->name);
+        length = xwb->size - start;
+    }
+    const uint8_t * payload = xwb->data + start;
+    
+    const char * ext = xwb_codec_exts[codec];
+    
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s%c%s.%s", basepath, xwb->name, SEPARATOR, name, ext);
+    FILE * out = fopen(path, "wb");
+    if (!out) {
+        fprintf(stderr, "Failed to open output file: %s\n", path);
+        return 0;
+    }
+    
+    bool loops = track->loop.len > 0;
+    
+    // Generate header
+    switch (codec) {
+    case XWB_CODEC_PCM: {
+        // 16 bit samples are copied so they are aligned, 8 bit ones only for the meter
+        uint32_t frame_count = length / blockAlign;
+        int16_t * pcm = malloc(frame_count * chans * sizeof(int16_t));
+        if (bits == 16) {
+            memcpy(pcm, payload, frame_count * blockAlign);
+            write_pcm16(out, xwb, i, pcm, chans, frame_count, loops);
+            free(pcm);
+            break;
         }
         
-        const char * ext = xwb_codec_exts[codec];
-        
-        snprintf(path, sizeof(path), "%s%s%c%s.%s", basepath, xwb_name, SEPARATOR, name, ext);
-        FILE * out = fopen(path, "wb");
-        if (!out) {
-            fprintf(stderr, "Failed to open output file: %s\n", path);
-            continue;
-        }
+        for (size_t s = 0; s < (size_t)frame_count * chans; s++) pcm[s] = (payload[s] - 0x80) << 8;
+        measure_track(xwb, i, pcm, chans, frame_count);
+        free(pcm);
         
-        bool loops = track->loop.len > 0;
+        struct wav_header header = {0x0001, chans, rate};
+        header.blockAlign = blockAlign;
+        header.avgBytesPerSec = header.blockAlign * rate;
+        header.bitsPerSample = bits;
         
-        // Generate header
-        switch (codec) {
-        case XWB_CODEC_PCM: {
-            struct wav_header header = {0x0001, chans, rate};
-            header.blockAlign = blockAlign;
-            header.avgBytesPerSec = header.blockAlign * rate;
-            header.bitsPerSample = bits;
-            
-            write_wav_header(out, &header, track->play.len, loops); 
-        } break;
-        case XWB_CODEC_ADPCM: {
-            struct xadpcm_wav_header header = {{0x0069, chans, rate}, 64};
-            header.wav.blockAlign = blockAlign;
-            header.wav.bitsPerSample = 4;
-            header.wav.extraSize = 2;
-            uint32_t dw = (((header.wav.blockAlign - (7 * chans)) * 8) / (4 * chans)) + 2;
-            header.wav.avgBytesPerSec = (rate / dw) * header.wav.blockAlign;
-            
-            write_wav_header(out, &header.wav, track->play.len, loops);
-        } break;
-        // WMA files are ready to go as the header is encoded with the data
-        default:
-            loops = false;
+        write_wav_header(out, &header, track->play.len, loops); 
+        fwrite(payload, 1, length, out);
+    } break;
+    case XWB_CODEC_ADPCM: {
+        if (chans > XADPCM_CHANNELS_MAX) {
+            fprintf(stderr, "Too many ADPCM channels: %u\n", chans);
+            fclose(out);
+            return 0;
         }
         
-        fseek(xwb, segments[3].pos + track->play.pos, SEEK_SET);
-        for (uint32_t i = 0; i < track->play.len; i++) {
-            int byte = fgetc(xwb);
-            if (byte == EOF) {
-                fprintf(stderr, "Unexpected EOF\n");
-                break;
-            }
-            fputc(byte, out);
-        }
+        uint32_t block_count = length / blockAlign;
+        uint32_t sample_count = block_count * XADPCM_BLOCK_SAMPLES;
         
-        if (loops) {
-            write_smpl_chunk(out, track);
-        }
+        int16_t * pcm = malloc(sample_count * chans * sizeof(int16_t));
+        decode_xadpcm(payload, block_count, chans, pcm);
+        write_pcm16(out, xwb, i, pcm, chans, sample_count, loops);
+        free(pcm);
         
-        fclose(out);
+        // Loop points were counted in blocks, the PCM wants samples
+        track->loop.pos *= XADPCM_BLOCK_SAMPLES;
+        track->loop.len *= XADPCM_BLOCK_SAMPLES;
+    } break;
+    // WMA files are ready to go as the header is encoded with the data
+    default:
+        fwrite(payload, 1, length, out);
+        loops = false;
+    }
+    
+    if (loops) {
+        write_smpl_chunk(out, track);
     }
     
-    fclose(xwb);
+    fclose(out);
     return 0;
 }
 
+/*
+ * Tracks of every bank are handed out one at a time to a pool of workers
+ */
+#define EXTRACT_THREADS_MAX 32
+
+struct extract_job {
+    struct xwb * xwb;
+    uint32_t track;
+};
+
+struct extract_job * extract_jobs;
+size_t extract_job_count;
+size_t extract_job_next;
+char * extract_basepath;
+bool extract_failed;
+pthread_mutex_t extract_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void * extract_worker(void * arg) {
+    while (true) {
+        pthread_mutex_lock(&extract_lock);
+        size_t j = extract_job_next++;
+        pthread_mutex_unlock(&extract_lock);
+        
+        if (j >= extract_job_count) break;
+        
+        if (extract_track(extract_basepath, extract_jobs[j].xwb, extract_jobs[j].track)) {
+            pthread_mutex_lock(&extract_lock);
+            extract_failed = true;
+            pthread_mutex_unlock(&extract_lock);
+        }
+    }
+    
+    return NULL;
+}
+
+int extract_xwbs(char * basepath, struct xwb * xwbs, uint32_t xwb_count) {
+    extract_job_count = 0;
+    for (uint32_t i = 0; i < xwb_count; i++) extract_job_count += xwbs[i].track_count;
+    
+    extract_jobs = malloc(extract_job_count * sizeof(struct extract_job));
+    extract_job_next = 0;
+    extract_basepath = basepath;
+    extract_failed = false;
+    
+    size_t j = 0;
+    for (uint32_t i = 0; i < xwb_count; i++) {
+        for (uint32_t t = 0; t < xwbs[i].track_count; t++) {
+            extract_jobs[j++] = (struct extract_job){xwbs + i, t};
+        }
+    }
+    
+#ifdef __linux__
+    long thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+#else
+    SYSTEM_INFO sysinfo;
+    GetSystemInfo(&sysinfo);
+    long thread_count = sysinfo.dwNumberOfProcessors;
+#endif
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > EXTRACT_THREADS_MAX) thread_count = EXTRACT_THREADS_MAX;
+    if (thread_count > extract_job_count) thread_count = extract_job_count;
+    
+    printf("Extracting %lu tracks on %ld threads\n", extract_job_count, thread_count);
+    
+    pthread_t threads[EXTRACT_THREADS_MAX];
+    long started = 0;
+    for (; started < thread_count; started++) {
+        if (pthread_create(threads + started, NULL, extract_worker, NULL)) break;
+    }
+    
+    // Do the work here if no thread could be started
+    if (!started) extract_worker(NULL);
+    
+    for (long t = 0; t < started; t++) pthread_join(threads[t], NULL);
+    
+    free(extract_jobs);
+    return extract_failed;
+}
+
 struct sndque {
     char name[32];
     int id;
@@ -445,14 +1041,34 @@ int main(int argc, char ** argv) {
     progname = *argv++; argc--;
 
     printf("SB Sound Tool - By QuantX\n");
+    
+    xadpcm_init_tables();
 
     if (!argc) {
-        fprintf(stderr, "Please specify an XSB soundbank file: %s <path/example.xsb>\n", progname);
+        fprintf(stderr, "Please specify an XSB soundbank file: %s <path/example.xsb> (--surround) "
+            "(--downmix <center>,<surround>,<lfe>)\n", progname);
         return 1;
     }
     
     char * path = *argv++; argc--;
     
+    while (argc) {
+        char * arg = *argv++; argc--;
+        
+        if (!strcmp(arg, "--surround")) {
+            downmix = false;
+        } else if (!strcmp(arg, "--downmix") && argc) {
+            if (sscanf(*argv, "%f,%f,%f", &downmix_center, &downmix_surround, &downmix_lfe) != 3) {
+                fprintf(stderr, "Please specify the downmix levels as <center>,<surround>,<lfe>\n");
+                return 1;
+            }
+            argv++; argc--;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", arg);
+            return 1;
+        }
+    }
+    
     char * ext = strrchr(path, '.');
     if (ext && !strcmp(ext + 1, "seg")) return unpackDATA(path);
     
@@ -528,12 +1144,9 @@ int main(int argc, char ** argv) {
         xwb_names[i] = string_table + (i * 16);
     }
     
-    int xwb_track_counts[xwb_count];
-    char ** xwb_track_names[xwb_count];
+    struct xwb * xwbs = calloc(xwb_count, sizeof(struct xwb));
     for (uint32_t i = 0; i < xwb_count; i++) {
-        xwb_track_counts[i] = get_xwb_track_count(path, xwb_names[i]);
-        if (xwb_track_counts[i] < 0) return 1;
-        xwb_track_names[i] = calloc(xwb_track_counts[i], sizeof(char *));
+        if (load_xwb(path, xwb_names[i], xwbs + i)) return 1;
     }
     
     for (uint32_t i = 0; i < cue_count; i++) {
@@ -615,9 +1228,9 @@ int main(int argc, char ** argv) {
             return 1;
         }
         
-        if (track >= xwb_track_counts[bank]) {
+        if (track >= xwbs[bank].track_count) {
             printf("Invalid track id %d for bank %d with %d tracks for cue %04d name \"%.16s\" sound %04d\n",
-                track, bank, xwb_track_counts[bank], i, name, cue->sound);
+                track, bank, xwbs[bank].track_count, i, name, cue->sound);
             return 1;
         }
         
@@ -625,13 +1238,23 @@ int main(int argc, char ** argv) {
         sound->track = track;
         sound->bank = bank;
         
+        float lfe = pow(10.0, XSB_SOUND_VOLUME_LFE(sound->lfe_volume) / 20.0);
+        if (lfe > xwbs[bank].track_lfe[track]) xwbs[bank].track_lfe[track] = lfe;
+        
         printf("Cue %04d name \"%.16s\": bank \"%s\", track %03d\n", i, name, xwb_names[bank], track);
         
-        if (!xwb_track_names[bank][track] || strlen(name) < strlen(xwb_track_names[bank][track])) {
-            xwb_track_names[bank][track] = name;
+        if (!xwbs[bank].track_names[track] || strlen(name) < strlen(xwbs[bank].track_names[track])) {
+            xwbs[bank].track_names[track] = name;
         }
     }
         
+    // Tracks are extracted before the JSON is written so their levels can go in it
+    for (uint32_t i = 0; i < xwb_count; i++) {
+        if (prepare_xwb(path, xwbs + i)) return 1;
+    }
+    
+    if (extract_xwbs(path, xwbs, xwb_count)) return 1;
+    
     jwOpen(json_buffer, sizeof(json_buffer), JW_OBJECT, JW_PRETTY);
     
     for (uint32_t i = 0; i < cue_count; i++) {
@@ -654,6 +1277,14 @@ int main(int argc, char ** argv) {
         jwObj_double("volume", volume);
         jwObj_double("volume_lfe", volume_lfe);
         jwObj_double("pitch", pow(2.0, (double)(sound->pitch) / 4096.0));
+        
+        struct track_levels * levels = xwbs[sound->bank].track_levels + sound->track;
+        if (levels->measured) {
+            jwObj_double("loudness", levels->loudness);
+            jwObj_double("true_peak", levels->true_peak);
+            jwObj_double("rms", levels->rms);
+        }
+        
         // jwObj_int("track_count", sound->track_count); // Always 1
         jwObj_int("layer", sound->layer);
         jwObj_int("category", sound->category);
@@ -683,7 +1314,7 @@ int main(int argc, char ** argv) {
         jwEnd();
         
         jwObj_string("bank", xwb_names[sound->bank]);
-        jwObj_string("file", xwb_track_names[sound->bank][sound->track]);
+        jwObj_string("file", xwbs[sound->bank].track_names[sound->track]);
         
         jwEnd(); // End of Sound Object
     }
@@ -705,11 +1336,8 @@ int main(int argc, char ** argv) {
     fwrite(json_buffer, sizeof(char), strlen(json_buffer), out);
     fclose(out);
     
-    for (uint32_t i = 0; i < xwb_count; i++) {
-        if (decode_xwb(path, xwb_names[i], xwb_track_names[i])) return 1; 
-    }
-    
-    for (uint32_t i = 0; i < xwb_count; i++) free(xwb_track_names[i]);
+    for (uint32_t i = 0; i < xwb_count; i++) free_xwb(xwbs + i);
+    free(xwbs);
     free(cues);
     free(sounds);
     free(string_table);
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
 #include <math.h>
 
 #include "jWrite.h"
@@ -34,6 +35,40 @@ char * basepath;
 char path[256];
 char json_buffer[1<<24]; // 1MB
 
+bool emit_instances = false;
+
+// Models placed at least this many times are grouped into an instance buffer
+#define INSTANCE_COUNT_MIN 2
+
+struct instance {
+    int16_t id;
+    int index; // Position in the objects array
+    float translation[3];
+    float rotation[4]; // Quaternion XYZW
+};
+
+void euler2quat(float quat[4], struct vector3 euler) {
+    // Conver from Euler to Quaternion
+    double cx = cos(euler.x * 0.5);
+    double sx = sin(euler.x * 0.5);
+    double cy = cos(euler.y * 0.5);
+    double sy = sin(euler.y * 0.5);
+    double cz = cos(euler.z * 0.5);
+    double sz = sin(euler.z * 0.5);
+    
+    quat[0] = sx * cy * cz - cx * sy * sz; // X
+    quat[1] = cx * sy * cz + sx * cy * sz; // Y
+    quat[2] = cx * cy * sz - sx * sy * cz; // Z
+    quat[3] = cx * cy * cz + sx * sy * sz; // W
+}
+
+int compare_instance(const void * a, const void * b) {
+    const struct instance * ia = a;
+    const struct instance * ib = b;
+    if (ia->id != ib->id) return ia->id - ib->id;
+    return ia->index - ib->index;
+}
+
 void emit_vector3(struct vector3 * v) {
     jwArr_double(v->x);
     jwArr_double(v->y);
@@ -100,6 +135,69 @@ int unpackRST(long map) {
     return 0;
 }
     
+// Groups repeated models into per-map TRS arrays laid out like EXT_mesh_gpu_instancing accessors
+int emitInstances(long map, struct instance * instances, int count) {
+    qsort(instances, count, sizeof(struct instance), compare_instance);
+    
+    snprintf(path, sizeof(path), "%smap%02ld.bin", basepath, map);
+    FILE * instf = fopen(path, "wb");
+    if (!instf) {
+        fprintf(stderr, "Failed to open output file: %s\n", path);
+        return 1;
+    }
+    
+    jwObj_object("instances");
+    jwObj_array("groups");
+    
+    uint32_t offset = 0;
+    int group_count = 0, instanced = 0;
+    
+    for (int start = 0, end; start < count; start = end) {
+        for (end = start + 1; end < count && instances[end].id == instances[start].id; end++);
+        
+        int inst_count = end - start;
+        if (inst_count < INSTANCE_COUNT_MIN) continue;
+        
+        jwArr_object();
+        jwObj_int("id", instances[start].id);
+        jwObj_int("count", inst_count);
+        
+        jwObj_array("objects");
+        for (int ii = start; ii < end; ii++) jwArr_int(instances[ii].index);
+        jwEnd();
+        
+        jwObj_object("translation");
+        jwObj_int("byteOffset", offset);
+        jwObj_string("type", "VEC3");
+        jwEnd();
+        
+        for (int ii = start; ii < end; ii++) fwrite(instances[ii].translation, sizeof(float), 3, instf);
+        offset += inst_count * 3 * sizeof(float);
+        
+        jwObj_object("rotation");
+        jwObj_int("byteOffset", offset);
+        jwObj_string("type", "VEC4");
+        jwEnd();
+        
+        for (int ii = start; ii < end; ii++) fwrite(instances[ii].rotation, sizeof(float), 4, instf);
+        offset += inst_count * 4 * sizeof(float);
+        
+        jwEnd();
+        
+        group_count++;
+        instanced += inst_count;
+    }
+    
+    jwEnd();
+    jwObj_int("byteLength", offset);
+    jwEnd();
+    
+    fclose(instf);
+    
+    printf("Grouped %d of %d objects into %d instance groups\n", instanced, count, group_count);
+    return 0;
+}
+
 int unpackSEG(long map) {
     if (sizeof(struct stage_object) != 96) {
         fprintf(stderr, "stage_object was not 96 bytes\n");
@@ -121,6 +219,8 @@ int unpackSEG(long map) {
     
     jwObj_array("objects");
     
+    struct instance * instances = NULL;
+    
     int obj_count;
     for (obj_count = 0; 1; obj_count++) {
         struct stage_object obj;
@@ -165,6 +265,17 @@ int unpackSEG(long map) {
         jwObj_int("flags", obj.flags);
         
         jwEnd();
+        
+        if (emit_instances) {
+            instances = realloc(instances, (obj_count + 1) * sizeof(struct instance));
+            struct instance * inst = instances + obj_count;
+            inst->id = obj.id;
+            inst->index = obj_count;
+            inst->translation[0] = obj.pos.x;
+            inst->translation[1] = obj.pos.y;
+            inst->translation[2] = obj.pos.z;
+            euler2quat(inst->rotation, obj.dir);
+        }
     }
     
     jwEnd();
@@ -172,6 +283,12 @@ int unpackSEG(long map) {
     printf("Unpacked %d objects\n", obj_count);
 
     fclose(segf);
+    
+    if (emit_instances) {
+        if (emitInstances(map, instances, obj_count)) return 1;
+        free(instances);
+    }
+    
     return 0;
 }
 
@@ -360,7 +477,7 @@ int main(int argc, char ** argv) {
     printf("SB Stage Tool - By QuantX\n");
 
     if (!argc) {
-        fprintf(stderr, "Usage: %s <stage_number> (path)\n", progname);
+        fprintf(stderr, "Usage: %s <stage_number> (path) (--instances)\n", progname);
         return 1;
     }
     
@@ -377,11 +494,21 @@ int main(int argc, char ** argv) {
     
     argv++; argc--;
     
-    if (argc) {
+    if (argc && strncmp(*argv, "--", 2)) {
         basepath = *argv++; argc--;
     } else {
         basepath = "";
     }
+    
+    while (argc) {
+        if (!strcmp(*argv, "--instances")) {
+            emit_instances = true;
+        } else {
+            fprintf(stderr, "Unknown option: %s\n", *argv);
+            return 1;
+        }
+        argv++; argc--;
+    }
 
     snprintf(path, sizeof(path), "%s.data.seg", basepath);
     FILE * datf = fopen(path, "rb");
@@ -2,6 +2,12 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <string.h>
+#include <stdbool.h>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "dds.h"
 
@@ -11,20 +17,289 @@
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
+#define STB_DXT_IMPLEMENTATION
+#include "stb_dxt.h"
 
 #define MAP_WIDTH 280
 #define MAP_HEIGHT 280
 
+// Heightmap formats, named after their DXGI format
+#define HEIGHT_R32G32F 16
+#define HEIGHT_R16G16F 34
+#define HEIGHT_R16 56
+
+#define SURFACE_R8G8 49
+#define BUMP_BC5_UNORM 83
+#define TILE_R32F 41
+#define TILE_R8G8B8A8 28
+
 char * helpmsg = "Used pack and unpack SB heightmap terrain files\n"
 "Show help: sbterrain -h\n"
 "Unpack map: sbterrain -u map00.gnd\n"
-"Pack map: sbterrain -p map00.gnd\n";
+"Unpack map with a smaller heightmap: sbterrain -u -f <r32g32f|r16g16f|r16> map00.gnd\n"
+"Pack map: sbterrain -p map00.gnd\n"
+"Repack part of a map: sbterrain -p -r <x>,<y>,<width>,<height> map00.gnd\n"
+"Build LOD terrain chunks: sbterrain -l map00.gnd\n"
+"Build normal and slope maps: sbterrain -n map00.gnd\n"
+"Build tiled terrain package: sbterrain -t map00.gnd\n";
 
 char * progname;
 
+int height_format = HEIGHT_R32G32F;
+uint32_t dirty_rect[4]; // x, y, width, height
+
+uint16_t float_to_half(float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    
+    uint16_t sign = (bits >> 16) & 0x8000;
+    int32_t exponent = (int32_t)((bits >> 23) & 0xFF) - 127 + 15;
+    uint32_t mantissa = bits & 0x7FFFFF;
+    
+    if (exponent >= 31) return sign | 0x7C00; // Overflow to infinity
+    
+    if (exponent <= 0) {
+        // Subnormal half
+        if (exponent < -10) return sign;
+        mantissa |= 0x800000;
+        int shift = 14 - exponent;
+        uint16_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1) half++;
+        return sign | half;
+    }
+    
+    uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) half++; // Rounding may carry into the exponent, which is still correct
+    return half;
+}
+
+float half_to_float(uint16_t half) {
+    uint32_t exponent = (half >> 10) & 0x1F;
+    float mantissa = half & 0x3FF;
+    float value;
+    
+    if (!exponent) value = ldexpf(mantissa, -24);
+    else if (exponent == 31) value = INFINITY;
+    else value = ldexpf(mantissa + 1024.0f, exponent - 25);
+    
+    return half & 0x8000 ? -value : value;
+}
+
+// Pairs up the R and G channels into RG pixels
+void interleave(const float * r, const float * g, float * out, size_t count) {
+    size_t i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= count; i += 4) {
+        __m128 rv = _mm_loadu_ps(r + i);
+        __m128 gv = _mm_loadu_ps(g + i);
+        _mm_storeu_ps(out + i * 2, _mm_unpacklo_ps(rv, gv));
+        _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(rv, gv));
+    }
+#endif
+    for (; i < count; i++) {
+        out[i * 2] = r[i];
+        out[i * 2 + 1] = g[i];
+    }
+}
+
+
+/*
+ * Reads the R and G channels back from a heightmap DDS in any of the unpack formats. R16 files
+ * carry no G channel so g is left untouched for them.
+ */
+int read_heightmap(char * path, float * r, float * g) {
+    FILE * hmdf = fopen(path, "rb");
+    if (!hmdf) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    char magic[4];
+    struct dds_header header;
+    struct dds_header_dx10 header10;
+    fread(magic, sizeof(char), 4, hmdf);
+    fread(&header, sizeof(struct dds_header), 1, hmdf);
+    fread(&header10, sizeof(struct dds_header_dx10), 1, hmdf);
+    
+    if (strncmp(magic, "DDS ", 4) || strncmp(header.format.codeStr, "DX10", 4)) {
+        fprintf(stderr, "Not a DX10 DDS heightmap: %s\n", path);
+        fclose(hmdf);
+        return 1;
+    }
+    
+    if (header.width != MAP_WIDTH || header.height != MAP_HEIGHT) {
+        fprintf(stderr, "Heightmap has to be %ux%u, not %ux%u\n", MAP_WIDTH, MAP_HEIGHT, header.width, header.height);
+        fclose(hmdf);
+        return 1;
+    }
+    
+    size_t size = MAP_WIDTH * MAP_HEIGHT;
+    size_t pixel_size = header10.format == HEIGHT_R32G32F ? sizeof(float) * 2 :
+        header10.format == HEIGHT_R16G16F ? sizeof(uint16_t) * 2 :
+        header10.format == HEIGHT_R16 ? sizeof(uint16_t) : 0;
+    if (!pixel_size) {
+        fprintf(stderr, "Unsupported heightmap format: %u\n", header10.format);
+        fclose(hmdf);
+        return 1;
+    }
+    
+    uint8_t * pixels = malloc(size * pixel_size);
+    size_t read = fread(pixels, pixel_size, size, hmdf);
+    fclose(hmdf);
+    
+    if (read != size) {
+        fprintf(stderr, "Heightmap is too short: %s\n", path);
+        free(pixels);
+        return 1;
+    }
+    
+    if (header10.format == HEIGHT_R32G32F) {
+        float * rg = (float *)pixels;
+        for (size_t px = 0; px < size; px++) {
+            r[px] = rg[px * 2];
+            g[px] = rg[px * 2 + 1];
+        }
+    } else if (header10.format == HEIGHT_R16G16F) {
+        uint16_t * halves = (uint16_t *)pixels;
+        for (size_t px = 0; px < size; px++) {
+            r[px] = half_to_float(halves[px * 2]);
+            g[px] = half_to_float(halves[px * 2 + 1]);
+        }
+    } else {
+        float height_min, height_max;
+        memcpy(&height_min, header.reserved0, sizeof(float));
+        memcpy(&height_max, header.reserved0 + 1, sizeof(float));
+        
+        uint16_t * norms = (uint16_t *)pixels;
+        for (size_t px = 0; px < size; px++) {
+            r[px] = height_min + norms[px] / 65535.0f * (height_max - height_min);
+        }
+    }
+    
+    free(pixels);
+    return 0;
+}
+
+/*
+ * Rebuilds a .gnd from the DDS heightmap and TGA colour map next to it. With a dirty rectangle only
+ * that part of each channel is written into the existing .gnd.
+ */
 int pack(char * path) {
-    fprintf(stderr, "Not implemented\n");
-    return 1;
+    char * ext = strrchr(path, '.');
+    if (!ext) {
+        fprintf(stderr, "Path is missing extension: %s\n", path);
+        return 1;
+    }
+    
+    // Compare each value on its own, the sums can wrap around for huge inputs
+    if (dirty_rect[0] >= MAP_WIDTH || dirty_rect[2] > MAP_WIDTH - dirty_rect[0]
+        || dirty_rect[1] >= MAP_HEIGHT || dirty_rect[3] > MAP_HEIGHT - dirty_rect[1]) {
+        fprintf(stderr, "Region %u,%u %ux%u is outside of the %ux%u map\n",
+            dirty_rect[0], dirty_rect[1], dirty_rect[2], dirty_rect[3], MAP_WIDTH, MAP_HEIGHT);
+        return 1;
+    }
+    
+    size_t size = MAP_WIDTH * MAP_HEIGHT;
+    float * rChannel = malloc(size * sizeof(float));
+    float * gChannel = calloc(size, sizeof(float));
+    
+    // Anything the sources do not cover is kept from the current file
+    uint8_t * tail = NULL;
+    size_t tail_size = 0;
+    size_t channels_size = size * (sizeof(float) * 2 + 4);
+    
+    FILE * gndf = fopen(path, "rb");
+    if (gndf) {
+        fseek(gndf, size * sizeof(float), SEEK_SET);
+        fread(gChannel, sizeof(float), size, gndf);
+        
+        fseek(gndf, 0, SEEK_END);
+        size_t gnd_size = ftell(gndf);
+        if (gnd_size > channels_size) {
+            tail_size = gnd_size - channels_size;
+            tail = malloc(tail_size);
+            fseek(gndf, channels_size, SEEK_SET);
+            fread(tail, 1, tail_size, gndf);
+        }
+        fclose(gndf);
+    } else if (dirty_rect[2]) {
+        fprintf(stderr, "Can only repack a region of an existing map: %s\n", path);
+        return 1;
+    }
+    
+    strcpy(ext + 1, "dds");
+    printf("Reading terrain heightmap data from %s\n", path);
+    if (read_heightmap(path, rChannel, gChannel)) return 1;
+    
+    strcpy(ext + 1, "tga");
+    printf("Reading terrain colour map from %s\n", path);
+    
+    int width, height, channels;
+    uint8_t * texture = stbi_load(path, &width, &height, &channels, 4);
+    if (!texture) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    if (width != MAP_WIDTH || height != MAP_HEIGHT) {
+        fprintf(stderr, "Colour map has to be %ux%u, not %dx%d\n", MAP_WIDTH, MAP_HEIGHT, width, height);
+        return 1;
+    }
+    
+    // Swizzle the R and B channels back
+    for (int i = 0; i < size * 4; i += 4) {
+        uint8_t temp = texture[i];
+        texture[i] = texture[i + 2];
+        texture[i + 2] = temp;
+    }
+    
+    strcpy(ext + 1, "gnd");
+    
+    if (dirty_rect[2]) {
+        uint32_t x = dirty_rect[0], y = dirty_rect[1], w = dirty_rect[2], h = dirty_rect[3];
+        
+        gndf = fopen(path, "r+b");
+        if (!gndf) {
+            fprintf(stderr, "Failed to open %s\n", path);
+            return 1;
+        }
+        
+        printf("Repacking region %u,%u %ux%u of %s\n", x, y, w, h, path);
+        
+        for (uint32_t row = y; row < y + h; row++) {
+            size_t px = row * MAP_WIDTH + x;
+            
+            fseek(gndf, px * sizeof(float), SEEK_SET);
+            fwrite(rChannel + px, sizeof(float), w, gndf);
+            
+            fseek(gndf, (size + px) * sizeof(float), SEEK_SET);
+            fwrite(gChannel + px, sizeof(float), w, gndf);
+            
+            fseek(gndf, size * sizeof(float) * 2 + px * 4, SEEK_SET);
+            fwrite(texture + px * 4, sizeof(uint8_t), w * 4, gndf);
+        }
+    } else {
+        gndf = fopen(path, "wb");
+        if (!gndf) {
+            fprintf(stderr, "Failed to open %s\n", path);
+            return 1;
+        }
+        
+        printf("Writing terrain to %s\n", path);
+        
+        fwrite(rChannel, sizeof(float), size, gndf);
+        fwrite(gChannel, sizeof(float), size, gndf);
+        fwrite(texture, sizeof(uint8_t), size * 4, gndf);
+        if (tail) fwrite(tail, 1, tail_size, gndf);
+    }
+    
+    fclose(gndf);
+    
+    stbi_image_free(texture);
+    free(tail);
+    free(rChannel);
+    free(gChannel);
+    
+    return 0;
 }
 
 int unpack(char * path) {
@@ -56,16 +331,91 @@ int unpack(char * path) {
     header.width = MAP_WIDTH;
     header.height = MAP_HEIGHT;
     size_t size = header.width * header.height;
+    
+    float * rChannel = malloc(size * sizeof(float));
+    float * gChannel = malloc(size * sizeof(float));
+    
+    fread(rChannel, sizeof(float), size, gndf); // This channel stores the heightmap data
+    fread(gChannel, sizeof(float), size, gndf);
+    
+    // Stripe the R and G channels
+    float * rg = malloc(size * sizeof(float) * 2);
+    interleave(rChannel, gChannel, rg, size);
+    
+    size_t pixel_size = sizeof(float) * 2;
+    void * pixels = rg;
+    
+    float height_min = rChannel[0], height_max = rChannel[0];
+    for (size_t px = 1; px < size; px++) {
+        if (rChannel[px] < height_min) height_min = rChannel[px];
+        if (rChannel[px] > height_max) height_max = rChannel[px];
+    }
+    
+    double error_max = 0.0, error_sum = 0.0;
+    double g_error_max = 0.0, g_error_sum = 0.0;
+    
+    if (height_format == HEIGHT_R16G16F) {
+        uint16_t * halves = malloc(size * sizeof(uint16_t) * 2);
+        for (size_t i = 0; i < size * 2; i++) {
+            // Anything past the largest half would silently turn into infinity
+            if (!(fabsf(rg[i]) <= 65504.0f)) {
+                fprintf(stderr, "%s value %f at %zu,%zu does not fit in a half float, use -f r32g32f\n",
+                    i % 2 ? "G" : "Height", rg[i], i / 2 % MAP_WIDTH, i / 2 / MAP_WIDTH);
+                fclose(hmdf);
+                return 1;
+            }
+            
+            halves[i] = float_to_half(rg[i]);
+            
+            double error = fabs(half_to_float(halves[i]) - rg[i]);
+            if (i % 2) {
+                if (error > g_error_max) g_error_max = error;
+                g_error_sum += error * error;
+            } else {
+                if (error > error_max) error_max = error;
+                error_sum += error * error;
+            }
+        }
+        
+        pixel_size = sizeof(uint16_t) * 2;
+        pixels = halves;
+    } else if (height_format == HEIGHT_R16) {
+        // Only the heights are kept, spread over the whole range
+        float range = height_max > height_min ? height_max - height_min : 1.0f;
+        uint16_t * norms = malloc(size * sizeof(uint16_t));
+        for (size_t px = 0; px < size; px++) {
+            norms[px] = lroundf((rChannel[px] - height_min) / range * 65535.0f);
+            
+            double error = fabs(height_min + norms[px] / 65535.0f * range - rChannel[px]);
+            if (error > error_max) error_max = error;
+            error_sum += error * error;
+        }
+        
+        // The range is needed to get the heights back, it goes in the reserved header words
+        memcpy(header.reserved0, &height_min, sizeof(float));
+        memcpy(header.reserved0 + 1, &height_max, sizeof(float));
+        
+        pixel_size = sizeof(uint16_t);
+        pixels = norms;
+    }
+    
+    if (height_format != HEIGHT_R32G32F) {
+        printf("Height range %f to %f, max error %f, RMS error %f\n", height_min, height_max,
+            error_max, sqrt(error_sum / size));
+    }
+    if (height_format == HEIGHT_R16G16F) {
+        printf("G channel max error %f, RMS error %f\n", g_error_max, sqrt(g_error_sum / size));
+    }
 
     header.flags |= 0x8; // Linear size is provided
-    header.pitch = size * sizeof(float) * 2;
+    header.pitch = size * pixel_size;
 
     // Enable DX10 header
     memcpy(header.format.codeStr, "DX10", 4);
     header.format.flags = 0x4;
     
     struct dds_header_dx10 header10 = {
-        .format = 16, // R32G32F
+        .format = height_format,
         .dimensions = DDS_DX10_DIMENSION_2D,
         .arraySize = 1,
     };
@@ -73,19 +423,10 @@ int unpack(char * path) {
     fputs("DDS ", hmdf);
     fwrite(&header, sizeof(struct dds_header), 1, hmdf);
     fwrite(&header10, sizeof(struct dds_header_dx10), 1, hmdf);
+    fwrite(pixels, pixel_size, size, hmdf);
     
-    float * rChannel = malloc(size * sizeof(float));
-    float * gChannel = malloc(size * sizeof(float));
-    
-    fread(rChannel, sizeof(float), size, gndf); // This channel stores the heightmap data
-    fread(gChannel, sizeof(float), size, gndf);
-    
-    // Stripe the R and G channels
-    for (uint32_t px = 0; px < size; px++) {
-        fwrite(rChannel + px, sizeof(float), 1, hmdf);
-        fwrite(gChannel + px, sizeof(float), 1, hmdf);
-    }
-    
+    if (pixels != rg) free(pixels);
+    free(rg);
     free(rChannel);
     free(gChannel);
     
@@ -115,6 +456,87 @@ int unpack(char * path) {
     return 0;
 }
 
+// Unswizzles a level of 2 byte texels and flips the sign bit so the signed texels read as unsigned
+void unswizzle_signed_rg(const uint8_t * src, uint32_t width, uint32_t height, uint8_t * dst) {
+#ifdef __SSE2__
+    if (width >= 4 && height >= 4) {
+        uint32_t mask_x, mask_y, mask_z;
+        generate_swizzle_masks(width, height, 1, &mask_x, &mask_y, &mask_z);
+        
+        // The lowest four bits interleave x and y, so every 4x4 tile is 16 texels in a row
+        uint32_t tile_x = mask_x & ~0xFu, tile_y = mask_y & ~0xFu;
+        const __m128i sign = _mm_set1_epi8((char)0x80);
+        
+        uint32_t off_y = 0;
+        for (uint32_t y = 0; y < height; y += 4) {
+            uint32_t off_x = 0;
+            for (uint32_t x = 0; x < width; x += 4) {
+                const uint8_t * tile = src + (off_x + off_y) * 2;
+                for (uint32_t half = 0; half < 2; half++) {
+                    // Texel pairs come in as row 0, row 1, row 0, row 1
+                    __m128i v = _mm_loadu_si128((const __m128i *)(tile + half * 16));
+                    v = _mm_shuffle_epi32(_mm_xor_si128(v, sign), _MM_SHUFFLE(3, 1, 2, 0));
+                    
+                    uint8_t * row = dst + ((y + half * 2) * width + x) * 2;
+                    _mm_storel_epi64((__m128i *)row, v);
+                    _mm_storel_epi64((__m128i *)(row + width * 2), _mm_srli_si128(v, 8));
+                }
+                off_x = (off_x - tile_x) & tile_x;
+            }
+            off_y = (off_y - tile_y) & tile_y;
+        }
+        return;
+    }
+#endif
+    unswizzle_rect(src, width, height, dst, width * 2, 2);
+    for (size_t i = 0; i < (size_t)width * height * 2; i++) dst[i] ^= 0x80;
+}
+
+// Halves an RG level with a box filter, a side that is already 1 stays 1
+void downsample_rg(const uint8_t * src, uint32_t width, uint32_t height, uint8_t * dst) {
+    uint32_t dw = width > 1 ? width / 2 : 1, dh = height > 1 ? height / 2 : 1;
+    uint32_t sx = width > 1, sy = height > 1;
+    
+    for (uint32_t y = 0; y < dh; y++) {
+        for (uint32_t x = 0; x < dw; x++) {
+            const uint8_t * a = src + ((y * 2) * width + x * 2) * 2;
+            const uint8_t * b = a + sx * 2;
+            const uint8_t * c = a + sy * width * 2;
+            const uint8_t * d = c + sx * 2;
+            for (int ch = 0; ch < 2; ch++) {
+                dst[(y * dw + x) * 2 + ch] = (a[ch] + b[ch] + c[ch] + d[ch] + 2) / 4;
+            }
+        }
+    }
+}
+
+// Levels below 4x4 repeat their edge texels to fill the block
+size_t compress_bc5(const uint8_t * src, uint32_t width, uint32_t height, uint8_t * dst) {
+    uint8_t block[16 * 2];
+    size_t size = 0;
+    
+    for (uint32_t by = 0; by < height; by += 4) {
+        for (uint32_t bx = 0; bx < width; bx += 4) {
+            for (uint32_t y = 0; y < 4; y++) {
+                uint32_t sy = by + y < height ? by + y : height - 1;
+                for (uint32_t x = 0; x < 4; x++) {
+                    uint32_t sx = bx + x < width ? bx + x : width - 1;
+                    memcpy(block + (y * 4 + x) * 2, src + (sy * width + sx) * 2, 2);
+                }
+            }
+            stb_compress_bc5_block(dst + size, block);
+            size += 16;
+        }
+    }
+    
+    return size;
+}
+
+/*
+ * Water bump maps are signed two channel XRAW textures. They are written as BC5 with the sign bit
+ * flipped, so 0.5 is flat, and with the full mip chain down to 1x1. Levels missing from the XRAW
+ * are filtered down from the last one present.
+ */
 int convertXRAW(char * path) {
     char * ext = strrchr(path, '.');
     if (!ext) {
@@ -154,9 +576,55 @@ int convertXRAW(char * path) {
     printf("Converting XRAW width %u, height %u, levels %u, format %02X, unknown %02X\n",
         width, height, levels, xraw_format, xraw_unknown);
     
+    uint32_t mip_count = 1;
+    while ((width >> (mip_count - 1)) > 1 || (height >> (mip_count - 1)) > 1) mip_count++;
+    if (!levels || levels > mip_count) levels = mip_count;
+    
     // Skip to the data
     fseek(xraw, 16, SEEK_SET);
     
+    // Every level fits in the space of the first
+    size_t top_size = (size_t)width * height * 2;
+    uint8_t * xraw_texture = malloc(top_size);
+    uint8_t * level_texture = malloc(top_size);
+    uint8_t * prev_texture = malloc(top_size);
+    uint8_t * bc5_texture = NULL;
+    
+    size_t bc5_size = 0;
+    uint32_t level_w = width, level_h = height;
+    uint32_t prev_w = width, prev_h = height;
+    
+    for (uint32_t l = 0; l < mip_count; l++) {
+        if (l < levels) {
+            size_t level_size = (size_t)level_w * level_h * 2;
+            if (fread(xraw_texture, sizeof(uint8_t), level_size, xraw) != level_size) {
+                fprintf(stderr, "Unexpected EOF in level %u of %s\n", l, path);
+                fclose(xraw);
+                return 1;
+            }
+            unswizzle_signed_rg(xraw_texture, level_w, level_h, level_texture);
+        } else {
+            downsample_rg(prev_texture, prev_w, prev_h, level_texture);
+        }
+        
+        bc5_texture = realloc(bc5_texture, bc5_size + ((level_w + 3) / 4) * ((level_h + 3) / 4) * 16);
+        bc5_size += compress_bc5(level_texture, level_w, level_h, bc5_texture + bc5_size);
+        
+        // Keep this level around in case the next one has to be filtered from it
+        uint8_t * temp = prev_texture;
+        prev_texture = level_texture;
+        level_texture = temp;
+        prev_w = level_w;
+        prev_h = level_h;
+        
+        if (level_w > 1) level_w /= 2;
+        if (level_h > 1) level_h /= 2;
+    }
+    
+    fclose(xraw);
+    
+    if (levels < mip_count) printf("Generated %u missing mipmaps\n", mip_count - levels);
+    
     // Change path extension to DDS
     strcpy(ext + 1, "dds");
     
@@ -170,52 +638,709 @@ int convertXRAW(char * path) {
     
     header.width = width;
     header.height = height;
-    header.levels = levels;
-
-    header.flags |= 0x8;
-    //header.flags |= 0x20000 | 0x8; // Linear size is provided, mipmaps present
-    header.pitch = header.width * header.height * (sizeof(float) * 2);
+    header.levels = mip_count;
     
-    header.format.flags = 0x40; // RGB
-    header.format.rgbBitCount = 24;
-    header.format.rBitMask = 0xFF;
-    header.format.gBitMask = 0xFF00;
-    header.format.bBitMask = 0xFF0000;
+    header.flags |= 0x80000 | 0x20000; // Compressed texture linear size, mipmaps present
+    header.pitch = ((width + 3) / 4) * ((height + 3) / 4) * 16;
+    header.caps[0] = 0x1000 | 0x8 | 0x400000; // Texture, complex, mipmaps
+    
+    // Enable DX10 header
+    memcpy(header.format.codeStr, "DX10", 4);
+    header.format.flags = 0x4;
+    
+    struct dds_header_dx10 header10 = {
+        .format = BUMP_BC5_UNORM,
+        .dimensions = DDS_DX10_DIMENSION_2D,
+        .arraySize = 1,
+    };
     
     fputs("DDS ", dds);
     fwrite(&header, sizeof(struct dds_header), 1, dds);
+    fwrite(&header10, sizeof(struct dds_header_dx10), 1, dds);
+    fwrite(bc5_texture, sizeof(uint8_t), bc5_size, dds);
+    
+    free(xraw_texture);
+    free(level_texture);
+    free(prev_texture);
+    free(bc5_texture);
+    
+    fclose(dds);
+    
+    return 0;
+}
+
+/*
+ * Normals and slopes from central differences, one sample per unit of the heightmap.
+ * The heights are padded by one repeated sample on every side so the whole map goes through the
+ * same kernel, four samples at a time.
+ */
+void surface_kernel(const float * padded, float * nx, float * nz, float * slope, float * curvature) {
+    const size_t pw = MAP_WIDTH + 2;
+    
+    for (size_t z = 0; z < MAP_HEIGHT; z++) {
+        const float * up = padded + z * pw + 1;
+        const float * mid = up + pw;
+        const float * down = mid + pw;
+        size_t i = z * MAP_WIDTH;
+        size_t x = 0;
+#ifdef __SSE2__
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 four = _mm_set1_ps(4.0f);
+        for (; x + 4 <= MAP_WIDTH; x += 4) {
+            __m128 h = _mm_loadu_ps(mid + x);
+            __m128 left = _mm_loadu_ps(mid + x - 1);
+            __m128 right = _mm_loadu_ps(mid + x + 1);
+            __m128 top = _mm_loadu_ps(up + x);
+            __m128 bottom = _mm_loadu_ps(down + x);
+            
+            __m128 dx = _mm_mul_ps(_mm_sub_ps(right, left), half);
+            __m128 dz = _mm_mul_ps(_mm_sub_ps(bottom, top), half);
+            __m128 len = _mm_sqrt_ps(_mm_add_ps(one, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dz, dz))));
+            __m128 inv = _mm_div_ps(one, len);
+            
+            // Normal is (-dx, 1, -dz) normalized, its y is all the slope needs
+            _mm_storeu_ps(nx + i + x, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(dx, inv)));
+            _mm_storeu_ps(nz + i + x, _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(dz, inv)));
+            _mm_storeu_ps(slope + i + x, _mm_sub_ps(one, inv));
+            _mm_storeu_ps(curvature + i + x,
+                _mm_sub_ps(_mm_add_ps(_mm_add_ps(left, right), _mm_add_ps(top, bottom)), _mm_mul_ps(four, h)));
+        }
+#endif
+        for (; x < MAP_WIDTH; x++) {
+            float dx = (mid[x + 1] - mid[x - 1]) * 0.5f;
+            float dz = (down[x] - up[x]) * 0.5f;
+            float inv = 1.0f / sqrtf(1.0f + dx * dx + dz * dz);
+            
+            nx[i + x] = -dx * inv;
+            nz[i + x] = -dz * inv;
+            slope[i + x] = 1.0f - inv;
+            curvature[i + x] = (mid[x - 1] + mid[x + 1]) + (up[x] + down[x]) - 4.0f * mid[x];
+        }
+    }
+}
+
+// Copy of the heights with the edge samples repeated once around the map, for surface_kernel
+float * pad_heights(const float * heights) {
+    size_t pw = MAP_WIDTH + 2, ph = MAP_HEIGHT + 2;
+    float * padded = malloc(pw * ph * sizeof(float));
+    
+    for (size_t z = 0; z < MAP_HEIGHT; z++) {
+        float * row = padded + (z + 1) * pw;
+        memcpy(row + 1, heights + z * MAP_WIDTH, MAP_WIDTH * sizeof(float));
+        row[0] = row[1];
+        row[pw - 1] = row[pw - 2];
+    }
+    
+    memcpy(padded, padded + pw, pw * sizeof(float));
+    memcpy(padded + (ph - 1) * pw, padded + (ph - 2) * pw, pw * sizeof(float));
+    
+    return padded;
+}
+
+static inline uint8_t unorm8(float value) {
+    if (value < 0.0f) value = 0.0f;
+    if (value > 1.0f) value = 1.0f;
+    return lroundf(value * 255.0f);
+}
+
+int write_rg8(char * path, const uint8_t * pixels, float scale) {
+    FILE * ddsf = fopen(path, "wb");
+    if (!ddsf) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    struct dds_header header = DDS_HEADER_INIT;
+    header.width = MAP_WIDTH;
+    header.height = MAP_HEIGHT;
+    header.flags |= 0x8; // Linear size is provided
+    header.pitch = MAP_WIDTH * MAP_HEIGHT * 2;
+    memcpy(header.reserved0, &scale, sizeof(float));
+    
+    // Enable DX10 header
+    memcpy(header.format.codeStr, "DX10", 4);
+    header.format.flags = 0x4;
+    
+    struct dds_header_dx10 header10 = {
+        .format = SURFACE_R8G8,
+        .dimensions = DDS_DX10_DIMENSION_2D,
+        .arraySize = 1,
+    };
+    
+    fputs("DDS ", ddsf);
+    fwrite(&header, sizeof(struct dds_header), 1, ddsf);
+    fwrite(&header10, sizeof(struct dds_header_dx10), 1, ddsf);
+    fwrite(pixels, sizeof(uint8_t) * 2, MAP_WIDTH * MAP_HEIGHT, ddsf);
+    fclose(ddsf);
+    
+    return 0;
+}
+
+/*
+ * Writes map_normal.dds with the normal x and z remapped to 0-1 (y is always up and rebuilt from
+ * the other two) and map_slope.dds with the slope angle over 90 degrees and the curvature around
+ * 0.5. The largest curvature is stored in the first reserved header word to scale it back.
+ */
+int surface(char * path) {
+    char * ext = strrchr(path, '.');
+    if (!ext) {
+        fprintf(stderr, "Path is missing extension: %s\n", path);
+        return 1;
+    }
+
+    FILE * gndf = fopen(path, "rb");
+    if (!gndf) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    printf("Building terrain normals from %s\n", path);
     
-    uint8_t * xraw_texture = malloc(width * height * 2);
-    uint8_t * dds_texture = malloc(width * height * 2);
+    size_t size = MAP_WIDTH * MAP_HEIGHT;
+    float * heights = malloc(size * sizeof(float));
+    size_t r = fread(heights, sizeof(float), size, gndf);
+    fclose(gndf);
+    
+    if (r != size) {
+        fprintf(stderr, "Heightmap is too short, got %lu of %lu heights\n", r, size);
+        return 1;
+    }
+    
+    float * padded = pad_heights(heights);
+    free(heights);
+    
+    float * nx = malloc(size * sizeof(float));
+    float * nz = malloc(size * sizeof(float));
+    float * slope = malloc(size * sizeof(float));
+    float * curvature = malloc(size * sizeof(float));
+    surface_kernel(padded, nx, nz, slope, curvature);
     
-    for (uint32_t l = 0; l < levels; l++) {
-        fread(xraw_texture, sizeof(uint8_t), width * height * 2, xraw);
+    float curvature_max = 0.0f;
+    for (size_t i = 0; i < size; i++) curvature_max = fmaxf(curvature_max, fabsf(curvature[i]));
+    float curvature_scale = curvature_max > 0.0f ? 0.5f / curvature_max : 0.0f;
     
-        unswizzle_rect(
-            xraw_texture, width, height,
-            dds_texture, width * 2, 2
-        );
+    uint8_t * normals = malloc(size * 2);
+    uint8_t * slopes = malloc(size * 2);
+    float steepest = 0.0f;
+    for (size_t i = 0; i < size; i++) {
+        normals[i * 2] = unorm8(nx[i] * 0.5f + 0.5f);
+        normals[i * 2 + 1] = unorm8(nz[i] * 0.5f + 0.5f);
         
-        for (uint32_t i = 0; i < width * height; i++) {
-            // These are actually signed textures, so convert them to unsigned
-            uint8_t r = dds_texture[i * 2] - 0x80;
-            uint8_t g = dds_texture[i * 2 + 1] - 0x80;
-            uint8_t b = 0;
+        // The kernel gives 1 - cos, the lookup wants the angle
+        float angle = acosf(1.0f - slope[i]) / (float)M_PI_2;
+        slopes[i * 2] = unorm8(angle);
+        slopes[i * 2 + 1] = unorm8(0.5f + curvature[i] * curvature_scale);
+        steepest = fmaxf(steepest, angle);
+    }
+    
+    printf("Steepest slope %f degrees, max curvature %f\n", steepest * 90.0f, curvature_max);
+    
+    // Room for the longest suffix in place of the extension
+    size_t base_len = ext - path;
+    char * out_path = malloc(base_len + sizeof("_normal.dds"));
+    memcpy(out_path, path, base_len);
+    
+    strcpy(out_path + base_len, "_normal.dds");
+    if (write_rg8(out_path, normals, 1.0f)) return 1;
+    
+    strcpy(out_path + base_len, "_slope.dds");
+    if (write_rg8(out_path, slopes, curvature_max)) return 1;
+    
+    free(out_path);
+    free(normals);
+    free(slopes);
+    free(nx);
+    free(nz);
+    free(slope);
+    free(curvature);
+    free(padded);
+    
+    return 0;
+}
+
+/*
+ * Tiled terrain package, every layer of the map cut into TILE_SIZE tiles that can be paged in on
+ * their own. The header lists the layer formats and is followed by an offset table with one entry
+ * per tile and layer, tiles in rows from the top left. Each entry points at the tile's mips from
+ * the full tile down to 1x1, one after the other. Tiles past the edge of the map repeat its last
+ * sample.
+ */
+#define TILE_SIZE 64
+
+#define TILE_LAYER_HEIGHT 0
+#define TILE_LAYER_COLOUR 1
+#define TILE_LAYER_NORMAL 2
+#define TILE_LAYER_COUNT 3
+
+struct tile_entry {
+    uint32_t offset; // Bytes from the start of the file
+    uint32_t size;
+};
+
+// Cuts a tile out of a layer and appends it with all of its mips
+void append_tile(uint8_t ** data, size_t * data_size, const uint8_t * layer, size_t texel_size,
+    bool floats, uint32_t tx, uint32_t ty, struct tile_entry * entry) {
+    
+    size_t tile_size = 0;
+    for (uint32_t w = TILE_SIZE; w; w /= 2) tile_size += w * w * texel_size;
+    
+    // Tiles start on 16 bytes so the runtime can upload them straight from the mapped file
+    size_t padded = (tile_size + 15) & ~(size_t)15;
+    *data = realloc(*data, *data_size + padded);
+    uint8_t * tile = *data + *data_size;
+    memset(tile + tile_size, 0, padded - tile_size);
+    
+    entry->offset = *data_size;
+    entry->size = tile_size;
+    *data_size += padded;
+    
+    for (uint32_t y = 0; y < TILE_SIZE; y++) {
+        uint32_t sy = ty * TILE_SIZE + y;
+        if (sy > MAP_HEIGHT - 1) sy = MAP_HEIGHT - 1;
+        for (uint32_t x = 0; x < TILE_SIZE; x++) {
+            uint32_t sx = tx * TILE_SIZE + x;
+            if (sx > MAP_WIDTH - 1) sx = MAP_WIDTH - 1;
+            memcpy(tile + (y * TILE_SIZE + x) * texel_size, layer + (sy * MAP_WIDTH + sx) * texel_size, texel_size);
+        }
+    }
+    
+    // Box filter each mip from the one above it
+    uint8_t * src = tile;
+    for (uint32_t w = TILE_SIZE / 2; w; w /= 2) {
+        uint8_t * dst = src + w * w * 4 * texel_size;
+        for (uint32_t y = 0; y < w; y++) {
+            for (uint32_t x = 0; x < w; x++) {
+                const uint8_t * a = src + ((y * 2) * w * 2 + x * 2) * texel_size;
+                const uint8_t * c = a + w * 2 * texel_size;
+                uint8_t * out = dst + (y * w + x) * texel_size;
+                
+                if (floats) {
+                    float fa, fb, fc, fd;
+                    memcpy(&fa, a, sizeof(float));
+                    memcpy(&fb, a + texel_size, sizeof(float));
+                    memcpy(&fc, c, sizeof(float));
+                    memcpy(&fd, c + texel_size, sizeof(float));
+                    float avg = (fa + fb + fc + fd) * 0.25f;
+                    memcpy(out, &avg, sizeof(float));
+                } else {
+                    for (size_t ch = 0; ch < texel_size; ch++) {
+                        out[ch] = (a[ch] + a[texel_size + ch] + c[ch] + c[texel_size + ch] + 2) / 4;
+                    }
+                }
+            }
+        }
+        src = dst;
+    }
+}
+
+int tiles(char * path) {
+    char * ext = strrchr(path, '.');
+    if (!ext) {
+        fprintf(stderr, "Path is missing extension: %s\n", path);
+        return 1;
+    }
+
+    FILE * gndf = fopen(path, "rb");
+    if (!gndf) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    printf("Building terrain tiles from %s\n", path);
+    
+    size_t size = MAP_WIDTH * MAP_HEIGHT;
+    float * heights = malloc(size * sizeof(float));
+    uint8_t * colour = malloc(size * 4);
+    
+    size_t r = fread(heights, sizeof(float), size, gndf);
+    fseek(gndf, size * sizeof(float) * 2, SEEK_SET);
+    r += fread(colour, 4, size, gndf);
+    fclose(gndf);
+    
+    if (r != size * 2) {
+        fprintf(stderr, "Map is too short: %s\n", path);
+        return 1;
+    }
+    
+    // Swizzle the R and B channels
+    for (size_t i = 0; i < size * 4; i += 4) {
+        uint8_t temp = colour[i];
+        colour[i] = colour[i + 2];
+        colour[i + 2] = temp;
+    }
+    
+    float * padded = pad_heights(heights);
+    float * nx = malloc(size * sizeof(float));
+    float * nz = malloc(size * sizeof(float));
+    float * slope = malloc(size * sizeof(float));
+    float * curvature = malloc(size * sizeof(float));
+    surface_kernel(padded, nx, nz, slope, curvature);
+    
+    uint8_t * normals = malloc(size * 2);
+    for (size_t i = 0; i < size; i++) {
+        normals[i * 2] = unorm8(nx[i] * 0.5f + 0.5f);
+        normals[i * 2 + 1] = unorm8(nz[i] * 0.5f + 0.5f);
+    }
+    
+    free(padded);
+    free(nx);
+    free(nz);
+    free(slope);
+    free(curvature);
+    
+    uint32_t tiles_x = (MAP_WIDTH + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tiles_y = (MAP_HEIGHT + TILE_SIZE - 1) / TILE_SIZE;
+    uint32_t tile_count = tiles_x * tiles_y;
+    
+    uint32_t level_count = 0;
+    for (uint32_t w = TILE_SIZE; w; w /= 2) level_count++;
+    
+    uint32_t formats[TILE_LAYER_COUNT] = {
+        [TILE_LAYER_HEIGHT] = TILE_R32F,
+        [TILE_LAYER_COLOUR] = TILE_R8G8B8A8,
+        [TILE_LAYER_NORMAL] = SURFACE_R8G8,
+    };
+    
+    struct tile_entry * entries = calloc(tile_count * TILE_LAYER_COUNT, sizeof(struct tile_entry));
+    uint8_t * data = NULL;
+    size_t data_size = 0;
+    
+    for (uint32_t ty = 0; ty < tiles_y; ty++) {
+        for (uint32_t tx = 0; tx < tiles_x; tx++) {
+            struct tile_entry * entry = entries + (ty * tiles_x + tx) * TILE_LAYER_COUNT;
+            append_tile(&data, &data_size, (uint8_t *)heights, sizeof(float), true, tx, ty, entry + TILE_LAYER_HEIGHT);
+            append_tile(&data, &data_size, colour, 4, false, tx, ty, entry + TILE_LAYER_COLOUR);
+            append_tile(&data, &data_size, normals, 2, false, tx, ty, entry + TILE_LAYER_NORMAL);
+        }
+    }
+    
+    // Header and table are padded to 16 bytes too, the table entries are moved past them
+    size_t header_size = 4 + sizeof(uint32_t) * (7 + TILE_LAYER_COUNT) + tile_count * TILE_LAYER_COUNT * sizeof(struct tile_entry);
+    size_t header_padded = (header_size + 15) & ~(size_t)15;
+    for (uint32_t i = 0; i < tile_count * TILE_LAYER_COUNT; i++) entries[i].offset += header_padded;
+    
+    // Change path extension to TPK
+    strcpy(ext + 1, "tpk");
+    
+    FILE * tpkf = fopen(path, "wb");
+    if (!tpkf) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    uint32_t info[7] = {MAP_WIDTH, MAP_HEIGHT, TILE_SIZE, tiles_x, tiles_y, level_count, TILE_LAYER_COUNT};
+    uint8_t zeros[16] = {0};
+    
+    fwrite("TPK0", sizeof(char), 4, tpkf);
+    fwrite(info, sizeof(uint32_t), 7, tpkf);
+    fwrite(formats, sizeof(uint32_t), TILE_LAYER_COUNT, tpkf);
+    fwrite(entries, sizeof(struct tile_entry), tile_count * TILE_LAYER_COUNT, tpkf);
+    fwrite(zeros, 1, header_padded - header_size, tpkf);
+    fwrite(data, 1, data_size, tpkf);
+    fclose(tpkf);
+    
+    printf("Wrote %ux%u tiles of %u with %u levels, %lu bytes\n", tiles_x, tiles_y, TILE_SIZE, level_count,
+        header_padded + data_size);
+    
+    free(entries);
+    free(data);
+    free(normals);
+    free(colour);
+    free(heights);
+    
+    return 0;
+}
+
+/*
+ * CDLOD terrain chunks. Level 0 chunks cover CHUNK_CELLS cells at full detail, every level above
+ * covers twice the area with the same number of vertices until one chunk holds the whole map. Each
+ * vertex carries the height it morphs to when its chunk blends into the next level, which is the
+ * height of the coarser grid at the same spot. Every chunk ends with a skirt hanging below its
+ * edges to hide cracks against neighbours at another level.
+ */
+#define CHUNK_CELLS 32
+
+struct cdlod_chunk {
+    uint32_t lod;
+    uint32_t x, z; // First sample covered
+    uint32_t cols, rows; // Grid vertices
+    float min, max; // Surface height range
+    float error; // Largest height difference to the full detail map
+    float skirt; // Depth of the skirt below the edges
+    uint32_t first_child;
+    uint32_t child_count;
+    uint32_t vertex_offset; // Bytes from the start of the file
+    uint32_t vertex_count; // Grid vertices followed by the skirt
+    uint32_t index_offset;
+    uint32_t index_count;
+};
+
+static inline float map_height(const float * heights, int32_t x, int32_t z) {
+    if (x < 0) x = 0;
+    if (z < 0) z = 0;
+    if (x > MAP_WIDTH - 1) x = MAP_WIDTH - 1;
+    if (z > MAP_HEIGHT - 1) z = MAP_HEIGHT - 1;
+    return heights[z * MAP_WIDTH + x];
+}
+
+// Height of the grid with the given step at a sample, using the same diagonal as the cells. The
+// last cell along the right and bottom edges is cut short at the map border like the chunk grids.
+float grid_height(const float * heights, uint32_t step, uint32_t x, uint32_t z) {
+    uint32_t gx = x / step * step, gz = z / step * step;
+    uint32_t gx1 = gx + step, gz1 = gz + step;
+    if (gx1 > MAP_WIDTH - 1) gx1 = MAP_WIDTH - 1;
+    if (gz1 > MAP_HEIGHT - 1) gz1 = MAP_HEIGHT - 1;
+    
+    float fx = gx1 > gx ? (float)(x - gx) / (gx1 - gx) : 0.0f;
+    float fz = gz1 > gz ? (float)(z - gz) / (gz1 - gz) : 0.0f;
+    
+    float h00 = map_height(heights, gx, gz);
+    float h10 = map_height(heights, gx1, gz);
+    float h01 = map_height(heights, gx, gz1);
+    float h11 = map_height(heights, gx1, gz1);
+    
+    if (fx >= fz) return h00 + fx * (h10 - h00) + fz * (h11 - h10);
+    return h00 + fz * (h01 - h00) + fx * (h11 - h01);
+}
+
+float grid_error(const float * heights, uint32_t step, uint32_t x0, uint32_t z0, uint32_t x1, uint32_t z1) {
+    float error = 0.0f;
+    for (uint32_t z = z0; z <= z1; z++) {
+        for (uint32_t x = x0; x <= x1; x++) {
+            error = fmaxf(error, fabsf(grid_height(heights, step, x, z) - heights[z * MAP_WIDTH + x]));
+        }
+    }
+    return error;
+}
+
+static void skirt_triangle(uint16_t * tri, const float * verts, float cx, float cz) {
+    const float * a = verts + tri[0] * 4;
+    const float * b = verts + tri[1] * 4;
+    const float * c = verts + tri[2] * 4;
+    
+    // Flip the triangle if it does not face away from the chunk
+    float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    float nx = e1[1] * e2[2] - e1[2] * e2[1];
+    float nz = e1[0] * e2[1] - e1[1] * e2[0];
+    if (nx * (a[0] - cx) + nz * (a[2] - cz) < 0.0f) {
+        uint16_t swap = tri[1];
+        tri[1] = tri[2];
+        tri[2] = swap;
+    }
+}
+
+int chunks(char * path) {
+    char * ext = strrchr(path, '.');
+    if (!ext) {
+        fprintf(stderr, "Path is missing extension: %s\n", path);
+        return 1;
+    }
+
+    FILE * gndf = fopen(path, "rb");
+    if (!gndf) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    printf("Building terrain chunks from %s\n", path);
+    
+    size_t size = MAP_WIDTH * MAP_HEIGHT;
+    float * heights = malloc(size * sizeof(float));
+    size_t r = fread(heights, sizeof(float), size, gndf);
+    fclose(gndf);
+    
+    if (r != size) {
+        fprintf(stderr, "Heightmap is too short, got %lu of %lu heights\n", r, size);
+        return 1;
+    }
+    
+    float map_min = heights[0], map_max = heights[0];
+    for (size_t i = 1; i < size; i++) {
+        map_min = fminf(map_min, heights[i]);
+        map_max = fmaxf(map_max, heights[i]);
+    }
+    
+    uint32_t lod_count = 1;
+    while ((CHUNK_CELLS << (lod_count - 1)) < MAP_WIDTH - 1 || (CHUNK_CELLS << (lod_count - 1)) < MAP_HEIGHT - 1) {
+        lod_count++;
+    }
+    
+    // Chunks from the root down, so the children of a chunk are always next to each other
+    struct cdlod_chunk * chunk_list = NULL;
+    size_t chunk_count = 0;
+    
+    chunk_list = calloc(1, sizeof(struct cdlod_chunk));
+    chunk_list[0].lod = lod_count - 1;
+    chunk_count = 1;
+    
+    for (size_t ci = 0; ci < chunk_count; ci++) {
+        struct cdlod_chunk chunk = chunk_list[ci];
+        if (!chunk.lod) continue;
+        
+        uint32_t half = CHUNK_CELLS << (chunk.lod - 1);
+        chunk_list[ci].first_child = chunk_count;
+        
+        for (int i = 0; i < 4; i++) {
+            uint32_t x = chunk.x + (i % 2) * half, z = chunk.z + (i / 2) * half;
+            if (x >= MAP_WIDTH - 1 || z >= MAP_HEIGHT - 1) continue;
+            
+            chunk_list = realloc(chunk_list, (chunk_count + 1) * sizeof(struct cdlod_chunk));
+            chunk_list[chunk_count] = (struct cdlod_chunk){.lod = chunk.lod - 1, .x = x, .z = z};
+            chunk_list[ci].child_count++;
+            chunk_count++;
+        }
+    }
+    
+    // Header and chunk table come first, vertices and indices of every chunk follow
+    size_t header_size = 4 + sizeof(uint32_t) * 5 + chunk_count * sizeof(struct cdlod_chunk);
+    size_t data_size = 0;
+    uint8_t * data = NULL;
+    
+    for (size_t ci = 0; ci < chunk_count; ci++) {
+        struct cdlod_chunk * chunk = chunk_list + ci;
+        uint32_t step = 1 << chunk->lod;
+        uint32_t x1 = chunk->x + (CHUNK_CELLS << chunk->lod), z1 = chunk->z + (CHUNK_CELLS << chunk->lod);
+        if (x1 > MAP_WIDTH - 1) x1 = MAP_WIDTH - 1;
+        if (z1 > MAP_HEIGHT - 1) z1 = MAP_HEIGHT - 1;
+        
+        chunk->cols = (x1 - chunk->x + step - 1) / step + 1;
+        chunk->rows = (z1 - chunk->z + step - 1) / step + 1;
+        
+        chunk->min = INFINITY;
+        chunk->max = -INFINITY;
+        for (uint32_t z = chunk->z; z <= z1; z++) {
+            for (uint32_t x = chunk->x; x <= x1; x++) {
+                chunk->min = fminf(chunk->min, heights[z * MAP_WIDTH + x]);
+                chunk->max = fmaxf(chunk->max, heights[z * MAP_WIDTH + x]);
+            }
+        }
+        
+        // The skirt has to cover the gap to a neighbour one level coarser
+        chunk->error = grid_error(heights, step, chunk->x, chunk->z, x1, z1);
+        float coarse_error = grid_error(heights, step * 2, chunk->x, chunk->z, x1, z1);
+        chunk->skirt = fmaxf(fmaxf(chunk->error, coarse_error), (map_max - map_min) * 0.01f);
+        
+        uint32_t grid_count = chunk->cols * chunk->rows;
+        uint32_t ring_count = 2 * (chunk->cols + chunk->rows) - 4;
+        chunk->vertex_count = grid_count + ring_count;
+        chunk->index_count = (chunk->cols - 1) * (chunk->rows - 1) * 6 + ring_count * 6;
         
-            fwrite(&r, sizeof(uint8_t), 1, dds);
-            fwrite(&g, sizeof(uint8_t), 1, dds);
-            fwrite(&b, sizeof(uint8_t), 1, dds);
+        // Vertices are x, height, z and the height to morph to
+        float * verts = malloc(chunk->vertex_count * sizeof(float) * 4);
+        uint16_t * inds = malloc(chunk->index_count * sizeof(uint16_t));
+        
+        for (uint32_t row = 0; row < chunk->rows; row++) {
+            for (uint32_t col = 0; col < chunk->cols; col++) {
+                uint32_t x = chunk->x + col * step, z = chunk->z + row * step;
+                if (x > x1) x = x1;
+                if (z > z1) z = z1;
+                
+                float * v = verts + (row * chunk->cols + col) * 4;
+                v[0] = x;
+                v[1] = heights[z * MAP_WIDTH + x];
+                v[2] = z;
+                v[3] = chunk->lod == lod_count - 1 ? v[1] : grid_height(heights, step * 2, x, z);
+            }
         }
         
-        width /= 2;
-        height /= 2;
+        // Edge ring going around the chunk, each vertex dropped by the skirt depth
+        uint32_t * ring = malloc(ring_count * sizeof(uint32_t));
+        uint32_t ri = 0;
+        for (uint32_t col = 0; col < chunk->cols - 1; col++) ring[ri++] = col;
+        for (uint32_t row = 0; row < chunk->rows - 1; row++) ring[ri++] = row * chunk->cols + chunk->cols - 1;
+        for (uint32_t col = chunk->cols - 1; col > 0; col--) ring[ri++] = (chunk->rows - 1) * chunk->cols + col;
+        for (uint32_t row = chunk->rows - 1; row > 0; row--) ring[ri++] = row * chunk->cols;
+        
+        for (uint32_t i = 0; i < ring_count; i++) {
+            float * v = verts + (grid_count + i) * 4;
+            memcpy(v, verts + ring[i] * 4, sizeof(float) * 4);
+            v[1] -= chunk->skirt;
+            v[3] -= chunk->skirt;
+        }
+        
+        // Cells are split along the diagonal from (x, z) to (x + 1, z + 1)
+        uint16_t * ind = inds;
+        for (uint32_t row = 0; row < chunk->rows - 1; row++) {
+            for (uint32_t col = 0; col < chunk->cols - 1; col++) {
+                uint16_t v00 = row * chunk->cols + col;
+                uint16_t v10 = v00 + 1;
+                uint16_t v01 = v00 + chunk->cols;
+                uint16_t v11 = v01 + 1;
+                *ind++ = v00; *ind++ = v11; *ind++ = v10;
+                *ind++ = v00; *ind++ = v01; *ind++ = v11;
+            }
+        }
+        
+        float cx = (chunk->x + x1) * 0.5f, cz = (chunk->z + z1) * 0.5f;
+        for (uint32_t i = 0; i < ring_count; i++) {
+            uint16_t a = ring[i], b = ring[(i + 1) % ring_count];
+            uint16_t la = grid_count + i, lb = grid_count + (i + 1) % ring_count;
+            ind[0] = a; ind[1] = la; ind[2] = lb;
+            ind[3] = a; ind[4] = lb; ind[5] = b;
+            skirt_triangle(ind, verts, cx, cz);
+            skirt_triangle(ind + 3, verts, cx, cz);
+            ind += 6;
+        }
+        
+        size_t vert_size = chunk->vertex_count * sizeof(float) * 4;
+        size_t ind_size = chunk->index_count * sizeof(uint16_t);
+        size_t ind_padded = (ind_size + 3) & ~3;
+        
+        data = realloc(data, data_size + vert_size + ind_padded);
+        chunk->vertex_offset = header_size + data_size;
+        memcpy(data + data_size, verts, vert_size);
+        data_size += vert_size;
+        
+        chunk->index_offset = header_size + data_size;
+        memcpy(data + data_size, inds, ind_size);
+        memset(data + data_size + ind_size, 0, ind_padded - ind_size);
+        data_size += ind_padded;
+        
+        free(ring);
+        free(verts);
+        free(inds);
     }
     
-    free(xraw_texture);
-    free(dds_texture);
+    // Change path extension to CDL
+    strcpy(ext + 1, "cdl");
     
-    fclose(dds);
-    fclose(xraw);
+    FILE * cdlf = fopen(path, "wb");
+    if (!cdlf) {
+        fprintf(stderr, "Failed to open %s\n", path);
+        return 1;
+    }
+    
+    uint32_t map_width = MAP_WIDTH, map_height = MAP_HEIGHT, chunk_cells = CHUNK_CELLS;
+    uint32_t chunk_total = chunk_count;
+    fwrite("CDL0", sizeof(char), 4, cdlf);
+    fwrite(&map_width, sizeof(uint32_t), 1, cdlf);
+    fwrite(&map_height, sizeof(uint32_t), 1, cdlf);
+    fwrite(&chunk_cells, sizeof(uint32_t), 1, cdlf);
+    fwrite(&lod_count, sizeof(uint32_t), 1, cdlf);
+    fwrite(&chunk_total, sizeof(uint32_t), 1, cdlf);
+    fwrite(chunk_list, sizeof(struct cdlod_chunk), chunk_count, cdlf);
+    fwrite(data, 1, data_size, cdlf);
+    fclose(cdlf);
+    
+    printf("Wrote %lu chunks over %u levels, %lu bytes\n", chunk_count, lod_count, header_size + data_size);
+    for (uint32_t l = 0; l < lod_count; l++) {
+        float error = 0.0f;
+        uint32_t count = 0;
+        for (size_t ci = 0; ci < chunk_count; ci++) {
+            if (chunk_list[ci].lod != l) continue;
+            error = fmaxf(error, chunk_list[ci].error);
+            count++;
+        }
+        printf("Level %u: %u chunks, max error %f\n", l, count, error);
+    }
+    
+    free(data);
+    free(chunk_list);
+    free(heights);
+    
+    return 0;
 }
 
 int main(int argc, char ** argv) {
@@ -230,9 +1355,35 @@ int main(int argc, char ** argv) {
         case 'h':
             printf("%s", helpmsg);
             return 0;
+        case 'f':
+            if (argc < 2) {
+                fprintf(stderr, "Please specify a heightmap format: r32g32f, r16g16f or r16\n");
+                return 1;
+            }
+            argv++; argc--;
+            
+            if (!strcmp(*argv, "r32g32f")) height_format = HEIGHT_R32G32F;
+            else if (!strcmp(*argv, "r16g16f")) height_format = HEIGHT_R16G16F;
+            else if (!strcmp(*argv, "r16")) height_format = HEIGHT_R16;
+            else {
+                fprintf(stderr, "Unknown heightmap format: %s\n", *argv);
+                return 1;
+            }
+            break;
+        case 'r':
+            if (argc < 2 || sscanf(argv[1], "%u,%u,%u,%u", dirty_rect, dirty_rect + 1, dirty_rect + 2, dirty_rect + 3) != 4
+                || !dirty_rect[2] || !dirty_rect[3]) {
+                fprintf(stderr, "Please specify a region as <x>,<y>,<width>,<height>\n");
+                return 1;
+            }
+            argv++; argc--;
+            break;
         case 'p':
         case 'u':
         case 'x':
+        case 'l':
+        case 'n':
+        case 't':
             progmode = **argv;
             break;
         }
@@ -240,7 +1391,7 @@ int main(int argc, char ** argv) {
     }
 
     if (!progmode) {
-        fprintf(stderr, "Please provide either '-p', '-u', or '-x', for help run: %s -h\n", progname);
+        fprintf(stderr, "Please provide either '-p', '-u', '-x', '-l', '-n' or '-t', for help run: %s -h\n", progname);
         return 1;
     }
 
@@ -248,12 +1399,18 @@ int main(int argc, char ** argv) {
         if (progmode == 'p') fprintf(stderr, "Please specify a map to pack\n");
         else if (progmode == 'u') fprintf(stderr, "Please specify a map unpack\n");
         else if (progmode == 'x') fprintf(stderr, "Please specify a raw file to unpack\n");
+        else if (progmode == 'l') fprintf(stderr, "Please specify a map to build chunks for\n");
+        else if (progmode == 'n') fprintf(stderr, "Please specify a map to build normals for\n");
+        else if (progmode == 't') fprintf(stderr, "Please specify a map to build tiles for\n");
         return 1;
     }
 
     if (progmode == 'p') return pack(*argv);
     else if (progmode == 'u') return unpack(*argv);
     else if (progmode == 'x') return convertXRAW(*argv);
+    else if (progmode == 'l') return chunks(*argv);
+    else if (progmode == 'n') return surface(*argv);
+    else if (progmode == 't') return tiles(*argv);
     
     fprintf(stderr, "Unknown progmode: %c\n", progmode);
     return 1;